@@ -1,387 +1,4937 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/file.h>
+#include <elf.h>
+#include <sys/resource.h>
+#include <sched.h>
+
+#include "crash.h"
 
 #define MAXLINE 1024
-#define MAXJOBS 65536
+#define MAXJOBS 65536 // live jobs; job numbers themselves keep counting past this
+#define SLOTS (2 * MAXJOBS) // size of the open-addressed job tables, power of two
+#define OUTBUF 65536
+#define REAPBATCH 256 // max children reaped per handler() call before input gets a turn
 #define KILLED 2
 #define RUNNING 1
 #define FINISHED 0
 #define SUSPENDED -1
+#define DUMPED 3
+#define DIRCACHE 16 // directory listings kept for glob expansion
+#define TRACERING 65536 // trace events kept between flushes; older unflushed ones are overwritten
 
-typedef struct {
+struct dagNode;
+
+// one allocation per job, freed when the job is reaped
+typedef struct job {
+    struct job *prev, *next; // live list, ascending job number
     pid_t PID;
     int jobNum;
-    int status; //1:running, 0:finished, -1:suspended 2:killed
-    const char *name;
-    bool valid;
+    int status; //1:running, 0:finished, -1:suspended 2:killed 3:killed (core dumped)
+    struct dagNode *dagNode; // set if launched by the dag builtin
+    struct schedule *sched;  // set if launched by every or repeat
+    int descendants;         // scratch for jobs -v
+    unsigned char limited;   // bit 1 << LIM_* for each resource limit it was started under
+    unsigned char sclass;    // CLASS_* it runs under in the background
+    unsigned char pressured; // stopped by the pressure monitor, which will continue it
+    int procFd[3];           // its /proc stat, statm and io for jtop, -1 where not held
+    unsigned long cpuTicks;  // utime + stime at jtop's last sample
+    uint64_t sampledAt;      // when that was, 0 if never
+    char name[];
 } job;
 
+typedef struct {
+    int key; // 0 if empty
+    job *val;
+} slot;
+
 static int currJob = 1;
-static job *jobList[MAXJOBS];
+static int liveCount = 0;
+static job *liveHead = NULL, *liveTail = NULL; // so jobs/nuke cost O(live), not O(ever started)
 
-static int getJobNum(int PID) {
-    for (size_t i = currJob; i > 0; i--)
-    {
-        pid_t currPID;
-        job *jobSearch = jobList[i];
-        if (jobSearch) currPID = jobSearch->PID;
-        if (jobSearch && jobSearch->PID == PID) {
-            return jobSearch->jobNum;
+// live jobs by PID and by job number: linear probing, deletion by backward shift so no tombstones
+static slot pidTable[SLOTS];
+static slot numTable[SLOTS];
+
+static int sigFd = -1;          // signalfd for SIGCHLD and the keyboard signals
+static int timerFd = -1;        // timerfd for every/repeat, armed for the earliest launch
+static sigset_t shellMask;      // signals delivered through sigFd
+static sigset_t origMask;       // restored in children before exec
+static pid_t fgPID = 0;         // foreground job, 0 if none
+static bool reapPending = false; // handler() stopped at REAPBATCH with children left
+static int fgStatus = 0;        // shell-style exit status of the last foreground job
+static int lastStatus = 0;      // exit status of the last command
+static bool fgBuiltin = false;  // an in-process builtin is running in the foreground
+static int interrupted = 0;      // keyboard signal that arrived while fgBuiltin was set, or 0
+static pid_t shellPID;
+static bool subreaper = false;  // orphaned descendants are reparented to us, not init
+static unsigned long orphansReaped = 0;
+
+// signal-forwarding latency: the last LATRING samples of each measurement, in microseconds
+#define LATRING 4096
+
+typedef struct {
+    const char *name;
+    uint64_t count;
+    uint32_t max;
+    uint32_t samples[LATRING];
+} latency;
+
+static latency fwdLatency = { "forward" }; // signalfd read to kill() returning
+static latency notifyLatency = { "notify" }; // that kill() to the job's stop or death being reported
+static uint64_t fwdTime = 0;               // when the last signal went to fgPID, until it reacts
+static unsigned long sigForwarded[3], sigIgnored[3]; // SIGINT, SIGQUIT, SIGTSTP
+
+// resource limits a job's child sets before exec; RLIM_INFINITY where there is none
+#define LIM_AS 0
+#define LIM_NOFILE 1
+#define LIM_CPU 2
+#define LIM_FSIZE 3
+#define NLIMITS 4
+
+typedef struct { rlim_t max[NLIMITS]; } jobLimits;
+
+static const struct { const char *name; int resource; } limitNames[NLIMITS] = {
+    [LIM_AS] = { "as", RLIMIT_AS }, [LIM_NOFILE] = { "nofile", RLIMIT_NOFILE },
+    [LIM_CPU] = { "cpu", RLIMIT_CPU }, [LIM_FSIZE] = { "fsize", RLIMIT_FSIZE },
+};
+static jobLimits limitDefaults = { { RLIM_INFINITY, RLIM_INFINITY, RLIM_INFINITY, RLIM_INFINITY } };
+static const jobLimits *launchLimits = &limitDefaults; // what the next job is started under
+static const int *launchTee = NULL;     // files the next job's stdout and stderr are also copied into
+static struct rlimit shellNofile;        // the descriptor limit crash started with
+static bool nofileRaised = false;        // crash itself runs with the hard limit instead
+
+// scheduling classes for background jobs; a job in the foreground always runs as normal
+#define CLASS_DEFAULT 0 // whatever bgClass is when the job goes to the background
+#define CLASS_NORMAL 1
+#define CLASS_NICE 2
+#define CLASS_BATCH 3
+#define CLASS_IDLE 4
+#define NCLASSES 5
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_WHO_PGRP 2
+#define IOPRIO(class, level) ((class) << IOPRIO_CLASS_SHIFT | (level))
+
+static const struct {
+    const char *name;
+    int policy, nice, ioprio; // ioprio 0 lets the I/O priority follow nice
+} classes[NCLASSES] = {
+    [CLASS_DEFAULT] = { "default", SCHED_OTHER, 0, 0 },
+    [CLASS_NORMAL] = { "normal", SCHED_OTHER, 0, 0 },
+    [CLASS_NICE] = { "nice", SCHED_OTHER, 10, 0 },
+    [CLASS_BATCH] = { "batch", SCHED_BATCH, 10, IOPRIO(2, 7) }, // best effort, lowest level
+    [CLASS_IDLE] = { "idle", SCHED_IDLE, 19, IOPRIO(3, 0) },    // idle I/O class
+};
+static int bgClass = CLASS_NORMAL;  // what CLASS_DEFAULT means
+static int launchClass = CLASS_NORMAL; // what the next job is started under
+
+struct builtin;
+
+// the process operations the job table is driven through; --sim swaps in a simulator
+typedef struct {
+    // starts a job's process, or the builtin inChild in a child, with its stdout and stderr
+    // on redirect[0..1] unless redirect is NULL; *execTime is set when tracing
+    pid_t (*spawn)(const char **toks, const struct builtin *inChild, const int *redirect, uint64_t *execTime);
+    // one state change, as waitpid(-1, status, WNOHANG | WUNTRACED | WCONTINUED)
+    pid_t (*reap)(int *status);
+    // kill(); a negative pid names a job's process group
+    int (*signal)(pid_t pid, int sig);
+    // called when a wait has nothing to do; false if the backend cannot make progress itself
+    bool (*idle)();
+} backend;
+
+static const backend *sys = NULL;
+
+// stdout messages are batched so a burst of notifications costs one write
+static char outBuf[OUTBUF];
+static size_t outLen = 0;
+
+static void flushOut() {
+    size_t off = 0;
+    while (off < outLen) {
+        ssize_t n = write(STDOUT_FILENO, outBuf + off, outLen - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    outLen = 0;
+}
+
+static void outWrite(const char *buf, size_t len);
+
+// formats into buf, or into a heap buffer if it needs more than size bytes; the caller frees
+// the result if it is not buf. NULL if it cannot be formatted.
+static char *vformat(char *buf, size_t size, int *len, const char *fmt, va_list ap) {
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(buf, size, fmt, ap);
+    if (n >= 0 && (size_t)n >= size) {
+        char *big = malloc(n + 1);
+        if (big) vsnprintf(big, n + 1, fmt, again);
+        buf = big;
+    }
+    va_end(again);
+    *len = n;
+    return n < 0 ? NULL : buf;
+}
+
+static void out(const char *fmt, ...) {
+    if (outLen + MAXLINE > OUTBUF) flushOut();
+    va_list ap;
+    va_start(ap, fmt);
+    int n;
+    char *msg = vformat(outBuf + outLen, MAXLINE, &n, fmt, ap);
+    va_end(ap);
+    if (msg == outBuf + outLen) {
+        outLen += n;
+    } else if (msg) { // longer than a line: written out whole, not cut off
+        outWrite(msg, n);
+        free(msg);
+    }
+}
+
+static void error(const char *fmt, ...) {
+    char buf[MAXLINE];
+    flushOut();
+    va_list ap;
+    va_start(ap, fmt);
+    int n;
+    char *msg = vformat(buf, sizeof(buf), &n, fmt, ap);
+    va_end(ap);
+    for (int off = 0, w; msg && off < n; off += w) {
+        if ((w = write(STDERR_FILENO, msg + off, n - off)) <= 0 && errno != EINTR) break;
+        if (w < 0) w = 0;
+    }
+    if (msg != buf) free(msg);
+}
+
+static size_t slotOf(int key) {
+    return ((size_t)key * 2654435761u) & (SLOTS - 1);
+}
+
+static void tableInsert(slot *table, int key, job *val) {
+    size_t i = slotOf(key);
+    while (table[i].key != 0 && table[i].key != key) i = (i + 1) & (SLOTS - 1);
+    table[i].key = key;
+    table[i].val = val;
+}
+
+static void tableRemove(slot *table, int key) {
+    size_t i = slotOf(key);
+    while (table[i].key != key) {
+        if (table[i].key == 0) return;
+        i = (i + 1) & (SLOTS - 1);
+    }
+    // shift later members of the probe chain back into the hole
+    size_t j = i;
+    for (;;) {
+        table[i].key = 0;
+        for (;;) {
+            j = (j + 1) & (SLOTS - 1);
+            if (table[j].key == 0) return;
+            size_t home = slotOf(table[j].key);
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+            break;
         }
+        table[i] = table[j];
+        i = j;
     }
-    return -1;
-    
 }
 
-static void quit(const char **toks) {
-    if (toks[1] != NULL) {
-            const char *msg = "ERROR: quit takes no arguments\n";
-            write(STDERR_FILENO, msg, strlen(msg));
-    } else {
-            exit(0);
+static job *tableGet(const slot *table, int key) {
+    size_t i = slotOf(key);
+    while (table[i].key != 0) {
+        if (table[i].key == key) return table[i].val;
+        i = (i + 1) & (SLOTS - 1);
     }
+    return NULL;
 }
 
-static void printJob(int i) {
-    job *currJob = jobList[i];
-        const char *status;
-        switch(currJob->status) {
-            case 1:
-                status = "running";
-                break;
-            case 0:
-                status = "finished";
-                break;
-            case -1:
-                status = "suspended";
-                break;
-            case 2:
-                status = "killed";
-                break;    
-            default:
-                status = NULL;
+// new jobs almost always have the highest number, so insertion scans from the tail
+static void liveInsert(job *j) {
+    job *after = liveTail;
+    while (after && after->jobNum > j->jobNum) after = after->prev;
+    j->prev = after;
+    j->next = after ? after->next : liveHead;
+    if (j->next) j->next->prev = j;
+    else liveTail = j;
+    if (after) after->next = j;
+    else liveHead = j;
+}
+
+static void liveRemove(job *j) {
+    if (j->prev) j->prev->next = j->next;
+    else liveHead = j->next;
+    if (j->next) j->next->prev = j->prev;
+    else liveTail = j->prev;
+}
+
+// Job lifecycle trace in Chrome's JSON array format (chrome://tracing, ui.perfetto.dev).
+// Events go into a fixed ring and are written out by traceFlush(); with tracing off,
+// every TRACE() costs one predictable branch.
+typedef struct {
+    uint64_t ts, dur;  // microseconds on CLOCK_MONOTONIC
+    const char *name;  // static string
+    int jobNum;        // 0 for the shell itself
+    pid_t pid;
+    int arg;           // exit status or signal, depending on the event
+    char ph;           // 'X' complete event, 'i' instant
+    char cmd[27];
+} traceEvent;
+
+static bool tracing = false;
+static int traceFd = -1;
+static traceEvent traceRing[TRACERING];
+static uint64_t traceHead = 0, traceFlushed = 0; // events recorded / written out, ever
+
+#define TRACE(...) do { if (__builtin_expect(tracing, 0)) traceRecord(__VA_ARGS__); } while (0)
+#define TRACE_START() (__builtin_expect(tracing, 0) ? traceNow() : 0)
+
+static uint64_t traceNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// ph 'X' spans from start until now; ph 'i' happens at start, or now if start is 0
+static void traceRecord(char ph, const char *name, uint64_t start, int jobNum, pid_t pid, int arg, const char *cmd) {
+    traceEvent *e = &traceRing[traceHead++ & (TRACERING - 1)];
+    uint64_t now = traceNow();
+    e->ph = ph;
+    e->name = name;
+    e->ts = start ? start : now;
+    e->dur = ph == 'X' ? now - start : 0;
+    e->jobNum = jobNum;
+    e->pid = pid;
+    e->arg = arg;
+    e->cmd[0] = '\0';
+    if (cmd) strncat(e->cmd, cmd, sizeof(e->cmd) - 1);
+}
+
+static void traceFlush() {
+    if (traceFd < 0) return;
+    if (traceHead - traceFlushed > TRACERING) {
+        dprintf(traceFd, "{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%llu,\"pid\":%d,\"tid\":0,"
+                "\"args\":{\"events\":%llu}},\n", (unsigned long long)traceNow(), getpid(),
+                (unsigned long long)(traceHead - traceFlushed - TRACERING));
+        traceFlushed = traceHead - TRACERING;
+    }
+    char line[MAXLINE];
+    for (; traceFlushed < traceHead; traceFlushed++) {
+        traceEvent *e = &traceRing[traceFlushed & (TRACERING - 1)];
+        char cmd[2 * sizeof(e->cmd)];
+        size_t c = 0;
+        for (const char *p = e->cmd; *p; p++) {
+            if (*p == '"' || *p == '\\') cmd[c++] = '\\';
+            cmd[c++] = (unsigned char)*p < 0x20 ? '?' : *p;
         }
-        const char* msg = (char*)malloc(MAXLINE);
-        const char *name = currJob->name;
-        snprintf(msg, MAXLINE, "[%d] (%d)  %s  %s\n", i, currJob->PID, status, currJob->name);
-        write(STDOUT_FILENO, msg, strlen(msg));
+        cmd[c] = '\0';
+        char dur[32] = "";
+        if (e->ph == 'X') snprintf(dur, sizeof(dur), "\"dur\":%llu,", (unsigned long long)e->dur);
+        int n = snprintf(line, sizeof(line),
+                         "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,%s\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"pid\":%d,\"arg\":%d,\"cmd\":\"%s\"}},\n",
+                         e->name, e->ph, (unsigned long long)e->ts, dur,
+                         getpid(), e->jobNum, e->pid, e->arg, cmd);
+        if (n > 0) write(traceFd, line, n < (int)sizeof(line) ? n : (int)sizeof(line) - 1);
+    }
+}
 
+// closes the JSON array so the file is valid JSON, not just loadable by the trace viewers
+static void traceFinish() {
+    if (traceFd < 0) return;
+    traceFlush();
+    dprintf(traceFd, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"crash\"}}]\n",
+            getpid());
+    close(traceFd);
+    traceFd = -1;
+    tracing = false;
 }
 
-static void jobs() {
-    for (size_t i = 1; i < currJob; i++)
-    {
-        if (jobList[i]->valid)
-        {
-            printJob(i);
+#ifndef CRASH_LIBRARY
+static bool traceOpen(const char *path) {
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0) return false;
+    write(traceFd, "[\n", 2);
+    tracing = true;
+    atexit(traceFinish);
+    return true;
+}
+#endif
+
+// for output that can be longer than one formatted message
+static void outWrite(const char *buf, size_t len) {
+    if (outLen + len > OUTBUF) flushOut();
+    if (len > OUTBUF) {
+        while (len > 0) {
+            ssize_t n = write(STDOUT_FILENO, buf, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            buf += n;
+            len -= n;
         }
+        return;
     }
+    memcpy(outBuf + outLen, buf, len);
+    outLen += len;
 }
 
-static void nuke(const char **toks) {
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigaddset(&mask, SIGTERM);
-    sigaddset(&mask, SIGINT);
-    sigprocmask(SIG_BLOCK, &mask, NULL);
-    if (toks[1] == NULL) {
-        //KILL all
-        for (size_t i = 1; i < currJob; i++)
-        {
-            job *killJob = jobList[i];
-            if (killJob && killJob->status == 1)
-            {
-                killJob->status = 2;
-                pid_t killJobPID = killJob->PID; 
-                kill(killJobPID, SIGKILL);
-            }
-            
+// --tag and --buffer: background jobs write into pipes that the shell relays
+#define OUT_DIRECT 0 // jobs share the shell's stdout and stderr
+#define OUT_TAG 1    // whole lines, each prefixed with [jobnum]
+#define OUT_SPLICE 2 // passed through untouched, spliced without a copy where possible
+#define STREAMBUF 65536
+
+typedef struct {
+    int fd, jobNum;
+    int dest;       // STDOUT_FILENO or STDERR_FILENO
+    int copy;       // memo's capture file, or -1; a stream with one is passed through untouched
+    size_t len, cap;
+    char *partial;  // unterminated tail of the last read, at most STREAMBUF
+} outStream;
+
+static int outMode = OUT_DIRECT;
+static outStream *streams = NULL; // open pipes, in no particular order
+static int streamCount = 0, streamCap = 0;
+static bool spliceBroken = false; // stdout or stderr refused splice(); copy instead
+static char errBuf[OUTBUF];       // tagged stderr lines of the current pump pass
+static size_t errLen = 0;
+
+static void flushErr() {
+    size_t off = 0;
+    flushOut();
+    while (off < errLen) {
+        ssize_t n = write(STDERR_FILENO, errBuf + off, errLen - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    errLen = 0;
+}
+
+static void sinkWrite(int dest, const char *buf, size_t len) {
+    if (dest == STDOUT_FILENO) {
+        outWrite(buf, len);
+        return;
+    }
+    if (errLen + len > OUTBUF) flushErr();
+    if (len > OUTBUF) {
+        errLen = 0;
+        while (len > 0) {
+            ssize_t n = write(STDERR_FILENO, buf, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            buf += n;
+            len -= n;
         }
-        
-    } else {
-        int i = 1;
-        while (toks[i] != NULL)
-        {
-            char * process = toks[i];
-            if (process[0] == '%')
-            {
-                int jobNumKill = 0;
-                int numReader = 1;
-                while (process[numReader] != '\0')
-                {
-                    jobNumKill = jobNumKill*10 + (process[numReader] - '0');
-                    numReader++;
-                }
-                
-                job * killJob = jobList[jobNumKill];
-                if (!killJob || !killJob->valid) {
-                    const char* msg = (char*)malloc(MAXLINE);
-                    snprintf(msg, MAXLINE,"ERROR: no job %d\n", jobNumKill);
-                    write(STDOUT_FILENO, msg, strlen(msg));
-                }
-                if (killJob && killJob->status == 1)
-                {
-                    killJob->status = 2;
-                    pid_t curPID = killJob->PID;
-                    kill(killJob->PID, SIGKILL);
-                }
-            } else {
-                //KILL process iff shell has not exited
-                pid_t currPID = strtol(process,NULL,0);
-                int jobNumKill = getJobNum(currPID);
-                if (jobNumKill != -1)
-                {
-                    job * killJob = jobList[jobNumKill];
-                    if (!killJob || !killJob->valid) {
-                        const char* msg = (char*)malloc(MAXLINE);
-                        snprintf(msg, MAXLINE,"ERROR: no PID %d\n", currPID);
-                        write(STDOUT_FILENO, msg, strlen(msg));
-                    }
-                    if (killJob && killJob->status == 1)
-                    {
-                        killJob->status = 2;
-                        pid_t curPID = killJob->PID;
-                        kill(killJob->PID, SIGKILL);
-                    }
-                } else {
-                    const char* msg = (char*)malloc(MAXLINE);
-                    snprintf(msg, MAXLINE,"ERROR: no job %d\n", currPID);
-                    write(STDOUT_FILENO, msg, strlen(msg));
-                }
-                
+        return;
+    }
+    memcpy(errBuf + errLen, buf, len);
+    errLen += len;
+}
+
+// one tagged line: the carried partial line, if any, then the rest of it from buf
+static void tagLine(outStream *s, const char *buf, size_t len) {
+    char tag[16];
+    sinkWrite(s->dest, tag, snprintf(tag, sizeof(tag), "[%d] ", s->jobNum));
+    sinkWrite(s->dest, s->partial, s->len);
+    sinkWrite(s->dest, buf, len);
+    if (len == 0 || buf[len - 1] != '\n') sinkWrite(s->dest, "\n", 1);
+    s->len = 0;
+}
+
+// creates the pipe pair for a job about to be spawned; fds[0..1] become its stdout and stderr
+static bool streamPipes(int readEnds[2], int writeEnds[2]) {
+    for (int i = 0; i < 2; i++) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) < 0) {
+            for (int j = 0; j < i; j++) {
+                close(readEnds[j]);
+                close(writeEnds[j]);
             }
-            i++;
+            return false;
         }
+        fcntl(p[0], F_SETFL, O_NONBLOCK);
+        readEnds[i] = p[0];
+        writeEnds[i] = p[1];
     }
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    return true;
 }
 
-static void foreground(const char **toks) {
-    if (toks[1] == NULL) {
-        const char *msg = "ERROR: fg requires at least one argument\n";
-        write(STDERR_FILENO, msg, strlen(msg));
-    } else {
-        bool error = false;
-        char *process = toks[1];
-        pid_t fgJob = 0;
-        if (process[0] == '%')
-        {
-            int jobNumFG = 0;
-            int numReader = 1;
-            while (process[numReader] != '\0')
-            {
-                jobNumFG = jobNumFG*10 + (process[numReader] - '0');
-                numReader++;
-            }
-            job *pushJob = jobList[jobNumFG];
-            if (!pushJob || !pushJob->valid) {
-                const char* msg = (char*)malloc(MAXLINE);
-                snprintf(msg, MAXLINE,"ERROR: no job %d\n", jobNumFG);
-                write(STDOUT_FILENO, msg, strlen(msg));
-                error = true;
-            } else {fgJob = pushJob->PID;}
+static void streamAdd(int fd, int jobNum, int dest, int copy) {
+    if (streamCount == streamCap) {
+        int cap = streamCap ? streamCap * 2 : 16;
+        outStream *grown = realloc(streams, cap * sizeof(*grown));
+        if (grown == NULL) {
+            perror("ERROR");
+            exit(1);
+        }
+        streams = grown;
+        streamCap = cap;
+    }
+    streams[streamCount++] = (outStream){ .fd = fd, .jobNum = jobNum, .dest = dest, .copy = copy };
+}
 
-        } else {
-            fgJob = strtol(toks[1],NULL,0);
-            int jobNum = getJobNum(fgJob);
-            job *pushJob = jobList[jobNum];
-            if (!pushJob || !pushJob->valid) {
-                const char* msg = (char*)malloc(MAXLINE);
-                snprintf(msg, MAXLINE,"ERROR: no PID %d\n", fgJob);
-                write(STDOUT_FILENO, msg, strlen(msg));
-                error = true;
-            }
+static void streamClose(int i) {
+    outStream *s = &streams[i];
+    if (s->len > 0) tagLine(s, "", 0);
+    close(s->fd);
+    if (s->copy >= 0) close(s->copy);
+    free(s->partial);
+    streams[i] = streams[--streamCount];
+}
+
+// relays what one readable stream has; false once it is closed. A stream gets one
+// STREAMBUF read per pass, so a fast producer fills its own pipe and blocks itself
+// rather than starving the prompt and the other jobs.
+static bool streamPump(int i) {
+    outStream *s = &streams[i];
+    static char chunk[STREAMBUF];
+    ssize_t n;
+    if (outMode == OUT_SPLICE && !spliceBroken && s->copy < 0) {
+        if (s->dest == STDOUT_FILENO) flushOut();
+        else flushErr();
+        n = splice(s->fd, NULL, s->dest, NULL, STREAMBUF, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n >= 0 || errno == EAGAIN || errno == EINTR) {
+            if (n != 0) return true;
+            streamClose(i);
+            return false;
         }
-        if (!error)
-        {
-            pid_t pidOut;
-            int status;
-            
-            waitpid(fgJob, &status, 0);
-            int jobNum = getJobNum(fgJob);
-            job *deadJob = jobList[jobNum];
-            deadJob->valid = false;
-            if (deadJob->status != KILLED) deadJob->status = FINISHED;
-            printJob(jobNum);
+        spliceBroken = errno == EINVAL; // e.g. a terminal or an O_APPEND file; copy from now on
+    }
+    n = read(s->fd, chunk, sizeof(chunk));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+    if (n <= 0) {
+        streamClose(i);
+        return false;
+    }
+    if (s->copy >= 0) {
+        for (ssize_t off = 0, w; off < n; off += w) {
+            if ((w = write(s->copy, chunk + off, n - off)) < 0 && errno != EINTR) break;
+            if (w < 0) w = 0;
+        }
+    }
+    if (outMode == OUT_SPLICE || s->copy >= 0) {
+        sinkWrite(s->dest, chunk, n);
+        return true;
+    }
+    const char *line = chunk, *end = chunk + n, *nl;
+    while ((nl = memchr(line, '\n', end - line)) != NULL) {
+        tagLine(s, line, nl + 1 - line);
+        line = nl + 1;
+    }
+    size_t rest = end - line;
+    if (rest == 0) return true;
+    if (s->len + rest > STREAMBUF) tagLine(s, "", 0); // no newline in sight; break the line here
+    if (s->len + rest > s->cap) {
+        s->cap = s->len + rest > 256 ? STREAMBUF : 256;
+        s->partial = realloc(s->partial, s->cap);
+        if (s->partial == NULL) {
+            perror("ERROR");
+            exit(1);
         }
-        
     }
+    memcpy(s->partial + s->len, line, rest);
+    s->len += rest;
+    return true;
 }
 
-static void background(const char **toks) {
-    if (toks[1] == NULL) {
-        const char *msg = "ERROR: bg requires at least one argument\n";
-        write(STDERR_FILENO, msg, strlen(msg));
-    } else {
-        int i = 1;
-        while (toks[i] != NULL)
-        {
-            char *process = toks[1];
-            if (process[0] == '%')
-            {
-                //send job %n to background
-            } else {
-                //send job n to background
-            }
-            i++;
+static int handler();
+static void scheduleTick();
+static void pressureStop();
+static void pressureTick();
+static void governorTick();
+static int psiFd, psiTimer, govTimer;
+
+#define POLLFIXED 6 // sigFd, timerFd, psiFd, psiTimer, govTimer and extra come before the streams
+
+// waits for a signal, relayed output, a scheduled launch or extra (if not NULL), runs the
+// handler and pumps every ready stream; returns poll()'s result. timeout as for ppoll(),
+// NULL for none.
+static int shellPoll(struct pollfd *extra, const struct timespec *timeout) {
+    static struct pollfd *pfds = NULL;
+    static int pfdCap = 0;
+    if (streamCount + POLLFIXED > pfdCap) {
+        pfdCap = (streamCount + POLLFIXED) * 2;
+        pfds = realloc(pfds, pfdCap * sizeof(*pfds));
+        if (pfds == NULL) {
+            perror("ERROR");
+            exit(1);
+        }
+    }
+    pfds[0] = (struct pollfd){ .fd = sigFd, .events = POLLIN };
+    pfds[1] = (struct pollfd){ .fd = timerFd, .events = POLLIN };
+    pfds[2] = (struct pollfd){ .fd = psiFd, .events = POLLPRI };
+    pfds[3] = (struct pollfd){ .fd = psiTimer, .events = POLLIN };
+    pfds[4] = (struct pollfd){ .fd = govTimer, .events = POLLIN };
+    pfds[5] = extra ? *extra : (struct pollfd){ .fd = -1 };
+    for (int i = 0; i < streamCount; i++) {
+        pfds[i + POLLFIXED] = (struct pollfd){ .fd = streams[i].fd, .events = POLLIN };
+    }
+    int n = streamCount + POLLFIXED;
+    struct timespec zero = { 0, 0 };
+    int ready = ppoll(pfds, n, reapPending ? &zero : timeout, NULL);
+    if (ready < 0) return ready;
+    // output first, so a job's last lines come before the notice that it finished
+    for (int i = n - 1; i >= POLLFIXED; i--) {
+        if (pfds[i].revents & POLLHUP) { // every writer is gone: take the rest now
+            while (streamPump(i - POLLFIXED)) continue;
+        } else if (pfds[i].revents) {
+            streamPump(i - POLLFIXED);
         }
     }
+    flushErr();
+    if (reapPending || (pfds[0].revents & POLLIN)) handler();
+    if (pfds[1].revents & POLLIN) scheduleTick();
+    if (pfds[2].revents & POLLPRI) pressureStop();
+    if (pfds[3].revents & POLLIN) pressureTick();
+    if (pfds[4].revents & POLLIN) governorTick();
+    if (extra) extra->revents = pfds[5].revents;
+    return ready;
 }
 
-static void runProcess(const char **toks, bool bg) {
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigaddset(&mask, SIGTERM);
-    sigaddset(&mask, SIGINT);    
-    sigprocmask(SIG_BLOCK, &mask, NULL);
-    char *process = toks[0];
-    int i = 0;
-    char *args[MAXLINE] = {};
-    while (toks[i] != NULL)
-    {
-        args[i] = toks[i];
-        i++;
-    }  
-    args[i] = NULL;
-    pid_t child = fork();
-    if (child == 0) {
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
-        int run = execvp(toks[0], args);
-        if (run == -1)
-        {
-            const char* msg = (char*)malloc(MAXLINE);
-            snprintf(msg, MAXLINE,"ERROR: cannot run %s\n", strdup(process));
-            write(STDOUT_FILENO, msg, strlen(msg));
-            exit(EXIT_FAILURE);
+#ifndef CRASH_LIBRARY
+// relays whatever the streams already hold, without waiting for more
+static void streamDrain() {
+    struct timespec zero = { 0, 0 };
+    if (streamCount > 0) shellPoll(NULL, &zero);
+}
+#endif
+
+// waits secs seconds while still reaping and relaying output; false if a keyboard signal cut it short
+static bool pauseShell(double secs) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)secs;
+    deadline.tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    if (sigFd < 0) { // in a forked child: nothing else to listen to
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+        return true;
+    }
+
+    bool wasBuiltin = fgBuiltin;
+    fgBuiltin = true;
+    interrupted = 0;
+    flushOut();
+    while (!interrupted) {
+        struct timespec now, left;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left.tv_sec = deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (left.tv_nsec < 0) {
+            left.tv_sec--;
+            left.tv_nsec += 1000000000;
         }
+        if (left.tv_sec < 0) break;
+        shellPoll(NULL, &left);
+    }
+    fgBuiltin = wasBuiltin;
+    return !interrupted;
+}
+
+static int quit(const char **toks, bool bg) {
+    if (toks[1] != NULL) {
+            error("ERROR: quit takes no arguments\n");
+            return 1;
     } else {
+            flushOut();
+            exit(0);
+    }
+}
 
-        job *childJob = malloc(sizeof(job));
-        childJob->PID = child;
-        childJob->jobNum = currJob++;
-        childJob->status = RUNNING;
-        childJob->name = strdup(process);
-        childJob->valid = true;
-        jobList[currJob - 1] = childJob;
-        if (!bg) { //if foreground, wait for death
-            pid_t pidOut;
-            int status;
-            
-            pidOut = waitpid(child, &status, 0);
-            int jobNum = getJobNum(pidOut);
-            job *deadJob = jobList[jobNum];
-            deadJob->valid = false;
-            if (deadJob->status != KILLED) deadJob->status = FINISHED;
-            printJob(jobNum);
-        } else {
-            printJob(currJob - 1);
+static const char *statusName(int status) {
+    switch(status) {
+        case RUNNING:
+            return "running";
+        case FINISHED:
+            return "finished";
+        case SUSPENDED:
+            return "suspended";
+        case KILLED:
+            return "killed";
+        case DUMPED:
+            return "killed (core dumped)";
+        default:
+            return NULL;
+    }
+}
+
+static void (*notifyHook)(const crash_job *job, const char *status) = NULL;
+static void (*signalHook)(int sig) = NULL; // keyboard signals nothing in the foreground took
+
+static void printJobStatus(const job *j, const char *status) {
+    if (notifyHook) {
+        crash_job info = { j->jobNum, j->PID, statusName(j->status), j->name };
+        notifyHook(&info, status);
+        return;
+    }
+    out("[%d] (%d)  %s  %s\n", j->jobNum, j->PID, status, j->name);
+}
+
+static void printJob(const job *j) {
+    printJobStatus(j, statusName(j->status));
+}
+
+typedef struct {
+    pid_t pid, ppid, pgrp;
+    unsigned long long start; // clock ticks after boot, so a reused PID is told apart
+    int owner;                // job number it descends from, 0 for none, -1 until resolved
+} procEntry;
+
+// every process the last snapshot saw, with the job it was first seen under; sorted by PID.
+// A descendant keeps its job when it is reparented to init or to us, double-forked or not.
+static procEntry *procSeen = NULL;
+static size_t procSeenCount = 0;
+
+static int procCmp(const void *a, const void *b) {
+    pid_t x = ((const procEntry *)a)->pid, y = ((const procEntry *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+// the leader PID in an adopted process's CRASH_JOB tag, if this shell set it; 0 otherwise
+static pid_t envOwner(pid_t pid) {
+    static char env[65536];
+    char path[64], tag[32];
+    snprintf(path, sizeof(path), "/proc/%d/environ", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t len = read(fd, env + 1, sizeof(env) - 2);
+    close(fd);
+    if (len <= 0) return 0;
+    env[0] = '\0'; // so the first variable matches like the others
+    env[len + 1] = '\0';
+    int tagLen = snprintf(tag, sizeof(tag), "%cCRASH_JOB=%d:", '\0', shellPID);
+    char *found = memmem(env, len + 1, tag, tagLen);
+    return found ? atoi(found + tagLen) : 0;
+}
+
+// the job number p descends from: by process group, by what it was first seen under, by its
+// parents, or if init or we adopted it, by the tag jobs carry with subreaper on
+static int resolveOwner(procEntry *procs, size_t n, procEntry *p, int depth) {
+    if (p->owner >= 0) return p->owner;
+    job *j = tableGet(pidTable, p->pid);
+    if (j == NULL) j = tableGet(pidTable, p->pgrp);
+    int owner = j ? j->jobNum : 0;
+    procEntry *seen = bsearch(p, procSeen, procSeenCount, sizeof(*p), procCmp);
+    if (owner == 0 && seen && seen->start == p->start && seen->owner > 0) owner = seen->owner;
+    bool adopted = p->ppid <= 1 || p->ppid == shellPID;
+    if (owner == 0 && !adopted && depth < 64) {
+        procEntry key = { .pid = p->ppid };
+        procEntry *parent = bsearch(&key, procs, n, sizeof(*procs), procCmp);
+        if (parent) owner = resolveOwner(procs, n, parent, depth + 1);
+    }
+    // read once per process: a process seen without an owner never gains one
+    if (owner == 0 && adopted && !(seen && seen->start == p->start)) {
+        j = tableGet(pidTable, envOwner(p->pid));
+        if (j) owner = j->jobNum;
+    }
+    if (owner > 0 && tableGet(numTable, owner) == NULL) owner = 0; // that job has ended
+    return p->owner = owner;
+}
+
+// every process's parent, process group and owning job, sorted by PID; the caller frees it
+static procEntry *procSnapshot(size_t *count) {
+    size_t n = 0, cap = 1024;
+    procEntry *procs = malloc(cap * sizeof(*procs));
+    DIR *proc = opendir("/proc");
+    struct dirent *d;
+    while (proc && (d = readdir(proc)) != NULL) {
+        if (d->d_name[0] < '1' || d->d_name[0] > '9') continue;
+        char path[64], stat[512];
+        snprintf(path, sizeof(path), "/proc/%.20s/stat", d->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        ssize_t len = read(fd, stat, sizeof(stat) - 1);
+        close(fd);
+        if (len <= 0) continue;
+        stat[len] = '\0';
+        // the command name may contain anything, so parse from the last ')'
+        char *rest = strrchr(stat, ')');
+        procEntry e = { .pid = atoi(d->d_name), .owner = -1 };
+        if (rest == NULL || sscanf(rest + 1, " %*c %d %d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+                                   &e.ppid, &e.pgrp, &e.start) != 3) continue;
+        if (n == cap) procs = realloc(procs, (cap *= 2) * sizeof(*procs));
+        procs[n++] = e;
+    }
+    if (proc) closedir(proc);
+    qsort(procs, n, sizeof(*procs), procCmp);
+    for (size_t i = 0; i < n; i++) resolveOwner(procs, n, &procs[i], 0);
+    procSeen = realloc(procSeen, (n ? n : 1) * sizeof(*procs));
+    memcpy(procSeen, procs, n * sizeof(*procs));
+    procSeenCount = n;
+    *count = n;
+    return procs;
+}
+
+// the live job p descends from, as procSnapshot() worked it out
+static job *ownerJob(const procEntry *p) {
+    if (tableGet(pidTable, p->pid)) return NULL; // a job itself
+    return p->owner > 0 ? tableGet(numTable, p->owner) : NULL;
+}
+
+// moves one process (0 for the caller) into a class; a job's later children inherit it
+static bool applyClass(pid_t pid, int cls) {
+    struct sched_param param = { 0 };
+    bool ok = sched_setscheduler(pid, classes[cls].policy, &param) == 0;
+    ok &= setpriority(PRIO_PROCESS, pid, classes[cls].nice) == 0;
+    ok &= syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, classes[cls].ioprio) == 0;
+    return ok;
+}
+
+static int jobClass(const job *j) {
+    return j->sclass == CLASS_DEFAULT ? bgClass : j->sclass;
+}
+
+static const backend osBackend;
+
+// moves a running job into a class, as it goes to or from the foreground: nice and I/O
+// priority for its whole process group at once. The policy has no group form, so only when
+// the leader's differs, or the leader is gone, does a snapshot find the group's processes
+// to move them one by one; switches between normal and nice never need it.
+static void setJobClass(const job *j, int cls) {
+    if (sys != &osBackend) return; // simulated PIDs are not ours to touch
+    bool ok = setpriority(PRIO_PGRP, j->PID, classes[cls].nice) == 0;
+    ok &= syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, j->PID, classes[cls].ioprio) == 0;
+    int policy = sched_getscheduler(j->PID);
+    if (policy >= 0) policy &= ~SCHED_RESET_ON_FORK;
+    if (policy != classes[cls].policy) {
+        struct sched_param param = { 0 };
+        size_t n;
+        procEntry *procs = procSnapshot(&n);
+        for (size_t i = 0; i < n; i++) {
+            if (procs[i].pgrp == j->PID) ok &= sched_setscheduler(procs[i].pid, classes[cls].policy, &param) == 0;
         }
-        sigprocmask(SIG_UNBLOCK, &mask, NULL);
-    } 
+        free(procs);
+    }
+    // raising priority again can need CAP_SYS_NICE; the job keeps running either way
+    if (!ok) error("ERROR: cannot move job %d to the %s class\n", j->jobNum, classes[cls].name);
 }
 
-void eval(const char **toks, bool bg) { // bg is true iff command ended with &
-    assert(toks);
-    if (*toks == NULL) return;
-    if (strcmp(toks[0], "quit") == 0) {
-        quit(toks);
-    } else if (strcmp(toks[0], "jobs") == 0) {
-        jobs();
-    } else if (strcmp(toks[0], "nuke") == 0) {
-        nuke(toks);
-    } else if (strcmp(toks[0], "fg") == 0) {
-        foreground(toks);
-    } else if (strcmp(toks[0], "bg") == 0) {
-        background(toks);
-    } else {
-        runProcess(toks, bg);
+struct schedule;
+static struct schedule *schedules;
+static void scheduleFree(struct schedule *s);
+static void listSchedules();
+static bool nukeSchedule(const char *arg, const procEntry *procs, size_t n);
+
+static int jobs(const char **toks, bool bg) {
+    bool verbose = toks[1] != NULL && strcmp(toks[1], "-v") == 0;
+    if (toks[verbose ? 2 : 1] != NULL) {
+        error("ERROR: jobs takes no arguments\n");
+        return 1;
     }
+    if (!verbose) {
+        for (job *j = liveHead; j; j = j->next) printJob(j);
+        listSchedules();
+        return 0;
+    }
+
+    size_t n;
+    procEntry *procs = procSnapshot(&n);
+    for (job *j = liveHead; j; j = j->next) j->descendants = 0;
+    int orphans = 0;
+    for (size_t i = 0; i < n; i++) {
+        job *owner = ownerJob(&procs[i]);
+        if (owner) owner->descendants++;
+        else if (procs[i].ppid == shellPID && !tableGet(pidTable, procs[i].pid)) orphans++;
+    }
+    free(procs);
+    for (job *j = liveHead; j; j = j->next) {
+        out("[%d] (%d)  %s  %s  descendants=%d class=%s\n", j->jobNum, j->PID, statusName(j->status), j->name,
+            j->descendants, classes[j->PID == fgPID ? CLASS_NORMAL : jobClass(j)].name);
+    }
+    listSchedules();
+    if (subreaper) out("orphans: %d adopted, %lu reaped\n", orphans, orphansReaped);
+    return 0;
 }
 
-void parse_and_eval(char *s) {
-    assert(s);
-    const char *toks[MAXLINE+1];
-    
-    while (*s != '\0') {
-        bool end = false;
-        bool bg = false;
-        int t = 0;
-
-        while (*s != '\0' && !end) {
-            while (*s == '\n' || *s == '\t' || *s == ' ') ++s;
-            if (*s != ';' && *s != '&' && *s != '\0') toks[t++] = s;
-            while (strchr("&;\n\t ", *s) == NULL) ++s;
-            switch (*s) {
-            case '&':
-                bg = true;
-                end = true;
-                break;
-            case ';':
-                end = true;
-                break;
+// resolves a %jobnum or PID argument to a live job, printing the spec's errors otherwise
+static job *lookupArg(const char *cmd, const char *arg) {
+    bool isJob = arg[0] == '%';
+    const char *num = isJob ? arg + 1 : arg;
+    char *end;
+    errno = 0;
+    long n = strtol(num, &end, 10);
+    if (*num == '\0' || *end != '\0' || errno != 0 || n <= 0 || n > 0x7fffffff) {
+        error("ERROR: bad argument for %s: %s\n", cmd, arg);
+        return NULL;
+    }
+    job *found = tableGet(isJob ? numTable : pidTable, n);
+    if (!found) error(isJob ? "ERROR: no job %ld\n" : "ERROR: no PID %ld\n", n);
+    return found;
+}
+
+// with procs set, also kills the job's process group and every descendant that left it
+static void nukeJob(job *killJob, const procEntry *procs, size_t n) {
+    TRACE('i', "nuke", 0, killJob->jobNum, killJob->PID, SIGKILL, killJob->name);
+    if (procs == NULL) {
+        sys->signal(killJob->PID, SIGKILL);
+        return;
+    }
+    sys->signal(-killJob->PID, SIGKILL);
+    for (size_t i = 0; i < n; i++) {
+        if (procs[i].pgrp != killJob->PID && ownerJob(&procs[i]) == killJob) kill(procs[i].pid, SIGKILL);
+    }
+}
+
+// nuke [-d] [PID | %job]...; -d takes each job's descendants down with it
+static int nuke(const char **toks, bool bg) {
+    int status = 0;
+    int first = 1;
+    procEntry *procs = NULL;
+    size_t n = 0;
+    if (toks[1] != NULL && strcmp(toks[1], "-d") == 0) {
+        procs = procSnapshot(&n);
+        first = 2;
+    }
+    if (toks[first] == NULL) {
+        //KILL all, schedules first so nothing relaunches
+        while (schedules) scheduleFree(schedules);
+        for (job *j = liveHead; j; j = j->next) nukeJob(j, procs, n);
+    } else {
+        for (int i = first; toks[i] != NULL; i++)
+        {
+            if (toks[i][0] == '@') {
+                if (!nukeSchedule(toks[i], procs, n)) status = 1;
+                continue;
             }
-            if (*s) *s++ = '\0';
+            job *killJob = lookupArg("nuke", toks[i]);
+            if (killJob) nukeJob(killJob, procs, n);
+            else status = 1;
         }
-        toks[t] = NULL;
-        eval(toks, bg);
     }
+    free(procs);
+    return status;
 }
 
-void prompt() {
-    const char *prompt = "crash> ";
-    ssize_t nbytes = write(STDOUT_FILENO, prompt, strlen(prompt));
+// runs handler() on every signal until the foreground job finishes or is suspended
+static void waitForeground(job *fgJob) {
+    uint64_t start = TRACE_START();
+    int jobNum = fgJob->jobNum;
+    fgPID = fgJob->PID;
+    fwdTime = 0;
+    flushOut();
+    while (fgPID != 0) {
+        if (!reapPending && sys->idle && sys->idle()) continue;
+        shellPoll(NULL, NULL);
+    }
+    TRACE('X', "foreground", start, jobNum, 0, fgStatus, NULL);
+    flushOut();
 }
 
-int repl() {
-    char *buf = NULL;
-    size_t len = 0;
-    while (prompt(), getline(&buf, &len, stdin) != -1) {
-        parse_and_eval(buf);
+static int foreground(const char **toks, bool bg) {
+    if (toks[1] == NULL || toks[2] != NULL) {
+        error("ERROR: fg needs exactly one argument\n");
+        return 1;
+    }
+    job *pushJob = lookupArg("fg", toks[1]);
+    if (!pushJob) return 1;
+    if (jobClass(pushJob) != CLASS_NORMAL) setJobClass(pushJob, CLASS_NORMAL); // full speed in front
+    if (pushJob->status == SUSPENDED) {
+        pushJob->status = RUNNING; // resumed by us, so handler() stays quiet
+        sys->signal(-pushJob->PID, SIGCONT);
     }
+    waitForeground(pushJob);
+    return fgStatus;
+}
 
-    if (buf != NULL) free(buf);
-    if (ferror(stdin)) {
-        perror("ERROR");
+static int className(const char *name) {
+    for (int i = 0; i < NCLASSES; i++) {
+        if (strcmp(name, classes[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+// bg [--class=CLASS] (PID | %job)...; resumes suspended jobs in the background, in CLASS if
+// given. bg --class=CLASS alone sets the class background jobs start in, and "default" jobs
+// run in; plain bg --class shows it.
+static int background(const char **toks, bool bg) {
+    int status = 0, first = 1, cls = -1;
+    if (toks[1] != NULL && strncmp(toks[1], "--class", 7) == 0) {
+        if (strcmp(toks[1], "--class") == 0 && toks[2] == NULL) {
+            out("background class: %s\n", classes[bgClass].name);
+            return 0;
+        }
+        cls = strncmp(toks[1], "--class=", 8) == 0 ? className(toks[1] + 8) : -1;
+        if (cls < 0 || (cls == CLASS_DEFAULT && toks[2] == NULL)) {
+            error("ERROR: bad argument for bg: %s\n", toks[1]);
+            return 1;
+        }
+        if (toks[2] == NULL) {
+            bgClass = cls;
+            return 0;
+        }
+        first = 2;
+    }
+    if (toks[first] == NULL) {
+        error("ERROR: bg needs some arguments\n");
         return 1;
     }
-    return 0;
+    for (int i = first; toks[i] != NULL; i++)
+    {
+        job *resumeJob = lookupArg("bg", toks[i]);
+        if (resumeJob && cls >= 0) resumeJob->sclass = cls;
+        // its class may just have changed, or fg may have lifted it to normal; a job left
+        // in normal keeps whatever nice or renice gave it
+        if (resumeJob && (cls >= 0 || jobClass(resumeJob) != CLASS_NORMAL)) setJobClass(resumeJob, jobClass(resumeJob));
+        if (resumeJob && resumeJob->status == SUSPENDED) {
+            resumeJob->status = RUNNING;
+            sys->signal(-resumeJob->PID, SIGCONT);
+            printJob(resumeJob);
+        } else if (!resumeJob) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+typedef struct builtin {
+    const char *name;
+    int (*run)(const char **toks, bool bg); // returns the command's exit status
+    bool trivial; // needs no shell state, so a backgrounded call can run in a fork without exec
+    bool asJob;   // trivial, and a job in the foreground too, so Ctrl+C and Ctrl+Z treat it as the real command
+} builtin;
+
+// in a job's child; a limit that cannot be set fails the launch rather than run it unbounded
+static void applyLimits(const jobLimits *l) {
+    for (int i = 0; i < NLIMITS; i++) {
+        if (l->max[i] == RLIM_INFINITY) {
+            if (i == LIM_NOFILE && nofileRaised) setrlimit(RLIMIT_NOFILE, &shellNofile);
+            continue;
+        }
+        // the spare second of hard CPU limit lets SIGXCPU, not SIGKILL, end the job
+        struct rlimit r = { l->max[i], i == LIM_CPU ? l->max[i] + 1 : l->max[i] };
+        if (setrlimit(limitNames[i].resource, &r) < 0) {
+            error("ERROR: cannot set %s limit: %s\n", limitNames[i].name, strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// run in a new job's leader: its descendants inherit the tag, so jobs -v and nuke -d can still
+// tell which job they came from after a double fork or setsid has cut them loose. Only with
+// subreaper on, as the tracking that asked for it; otherwise jobs get the shell's environment
+// untouched and are found by process group and parentage alone.
+static void tagJob() {
+    if (!subreaper) return;
+    char tag[32];
+    snprintf(tag, sizeof(tag), "%d:%d", shellPID, getpid());
+    setenv("CRASH_JOB", tag, 1);
+}
+
+static pid_t osSpawn(const char **toks, const builtin *inChild, const int *redirect, uint64_t *execTime) {
+    const char *process = toks[0];
+    // when tracing, the child reports the moment it calls exec through a close-on-exec pipe
+    int execPipe[2] = { -1, -1 };
+    if (tracing && pipe2(execPipe, O_CLOEXEC) < 0) execPipe[0] = execPipe[1] = -1;
+    pid_t child = fork();
+    if (child == 0) {
+        setpgid(0, 0);
+        close(sigFd);
+        sigFd = -1;
+        sigprocmask(SIG_SETMASK, &origMask, NULL);
+        applyLimits(launchLimits);
+        tagJob();
+        if (launchClass != CLASS_NORMAL) applyClass(0, launchClass);
+        if (redirect) {
+            dup2(redirect[0], STDOUT_FILENO);
+            dup2(redirect[1], STDERR_FILENO);
+        }
+        if (inChild) {
+            if (execPipe[1] >= 0) close(execPipe[1]);
+            int status = inChild->run(toks, false);
+            flushOut();
+            _exit(status);
+        }
+        if (execPipe[1] >= 0) {
+            uint64_t now = traceNow();
+            write(execPipe[1], &now, sizeof(now));
+        }
+        execvp(process, (char *const *)toks);
+        error("ERROR: cannot run %s\n", process);
+        _exit(EXIT_FAILURE);
+    }
+    if (execPipe[0] >= 0) {
+        close(execPipe[1]);
+        if (child > 0 && read(execPipe[0], execTime, sizeof(*execTime)) != sizeof(*execTime)) *execTime = 0;
+        close(execPipe[0]);
+    }
+    if (child > 0) setpgid(child, child); // also in the parent, so kill(-pid) works before the child runs
+    return child;
+}
+
+static pid_t osReap(int *status) {
+    return waitpid(-1, status, WNOHANG | WUNTRACED | WCONTINUED);
 }
 
-static void handler(int num) {
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
-    sigaddset(&mask, SIGTERM);
-    sigaddset(&mask, SIGINT);
-    sigprocmask(SIG_BLOCK, &mask, NULL);
+static const backend osBackend = { osSpawn, osReap, kill, NULL };
 
-    
-    pid_t pidOut;
-    int status;
+// in-memory process simulator (--sim): fake PIDs, a virtual millisecond clock and
+// scripted state changes, so the job table can be driven without the OS
+#define SIMPID0 (1 << 23) // above the kernel's PID_MAX_LIMIT, so never a real process
 
-    while ((pidOut = waitpid(-1, &status, WNOHANG)) > 0) {
-        int jobNum = getJobNum(pidOut);
-        job *deadJob = jobList[jobNum];
-        deadJob->valid = false;
-        if (deadJob->status != KILLED) deadJob->status = FINISHED;
-        printJob(jobNum);
+typedef struct {
+    bool alive, stopped;
+    int code;          // exit status once its lifetime runs out
+    uint64_t exitAt;   // virtual time of that exit, while running
+    uint64_t left;     // lifetime remaining, while stopped
+    unsigned gen;      // invalidates heap entries when the process is stopped or reused
+} simProc;
+
+typedef struct { uint64_t at; int slot; unsigned gen; } simTimer;
+typedef struct { pid_t pid; int status; } simEvent;
+
+static simProc *simProcs = NULL;
+static int simCap = 0, simUsed = 0;
+static int *simFree = NULL; // reaped slots, reused so PIDs are recycled like the kernel's
+static int simFreeCount = 0;
+static simTimer *simHeap = NULL; // min-heap of pending exits
+static int simHeapLen = 0, simHeapCap = 0;
+static simEvent *simQueue = NULL; // wait statuses not yet collected, oldest first
+static size_t simQHead = 0, simQTail = 0, simQCap = 0;
+static uint64_t simClock = 0;
+static uint64_t simLife = 1000; // lifetime of a command with no scripted one
+static unsigned long simSpawned = 0, simEvents = 0;
+
+static void *simGrow(void *p, int *cap, size_t size) {
+    int grown = *cap ? *cap * 2 : 1024;
+    p = realloc(p, grown * size);
+    if (p == NULL) {
+        perror("ERROR");
+        exit(1);
     }
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    *cap = grown;
+    return p;
 }
 
-int main(int argc, char **argv) {
-    struct sigaction sigact;
-    sigact.sa_handler = handler;
-    sigact.sa_flags = SA_RESTART;
-    sigemptyset(&sigact.sa_mask);
-    sigaction(SIGCHLD, &sigact, NULL);
-    
-    return repl();
-} 
+static void simHeapPush(uint64_t at, int slot) {
+    if (simHeapLen == simHeapCap) simHeap = simGrow(simHeap, &simHeapCap, sizeof(*simHeap));
+    int i = simHeapLen++;
+    while (i > 0 && simHeap[(i - 1) / 2].at > at) {
+        simHeap[i] = simHeap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    simHeap[i] = (simTimer){ at, slot, simProcs[slot].gen };
+}
+
+static simTimer simHeapPop() {
+    simTimer top = simHeap[0], last = simHeap[--simHeapLen];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= simHeapLen) break;
+        if (c + 1 < simHeapLen && simHeap[c + 1].at < simHeap[c].at) c++;
+        if (simHeap[c].at >= last.at) break;
+        simHeap[i] = simHeap[c];
+        i = c;
+    }
+    simHeap[i] = last;
+    return top;
+}
+
+// queues a wait status; nothing is raised per event, so any number of them share one SIGCHLD
+static void simPost(int slot, int status) {
+    if (simQTail - simQHead == simQCap) {
+        size_t cap = simQCap ? simQCap * 2 : 1024;
+        simEvent *grown = malloc(cap * sizeof(*grown));
+        if (grown == NULL) {
+            perror("ERROR");
+            exit(1);
+        }
+        for (size_t i = simQHead; i < simQTail; i++) grown[i - simQHead] = simQueue[i % simQCap];
+        free(simQueue);
+        simQueue = grown;
+        simQTail -= simQHead;
+        simQHead = 0;
+        simQCap = cap;
+    }
+    simQueue[simQTail++ % simQCap] = (simEvent){ SIMPID0 + slot, status };
+    simEvents++;
+    reapPending = true; // the simulated SIGCHLD; however many events pile up, it is one
+    if (status == 0xffff || (status & 0xff) == 0x7f) return;
+    simProcs[slot].alive = false;
+    simProcs[slot].gen++;
+}
+
+static int simSlot(pid_t pid) {
+    int slot = pid - SIMPID0;
+    return slot >= 0 && slot < simUsed && simProcs[slot].alive ? slot : -1;
+}
+
+static pid_t simSpawn(const char **toks, const builtin *inChild, const int *redirect, uint64_t *execTime) {
+    int slot;
+    if (simFreeCount > 0) {
+        slot = simFree[--simFreeCount];
+    } else {
+        if (simUsed == simCap) {
+            int cap = simCap;
+            simProcs = simGrow(simProcs, &simCap, sizeof(*simProcs));
+            simFree = simGrow(simFree, &cap, sizeof(*simFree));
+        }
+        slot = simUsed++;
+        simProcs[slot].gen = 0;
+    }
+    simProc *p = &simProcs[slot];
+    uint64_t life = simLife;
+    p->code = 0;
+    if (strcmp(toks[0], "true") == 0) {
+        life = 0;
+    } else if (strcmp(toks[0], "false") == 0) {
+        life = 0;
+        p->code = 1;
+    } else if (strcmp(toks[0], "sleep") == 0 && toks[1] != NULL) {
+        life = (uint64_t)(strtod(toks[1], NULL) * 1000);
+    }
+    p->alive = true;
+    p->stopped = false;
+    p->exitAt = simClock + life;
+    simHeapPush(p->exitAt, slot);
+    simSpawned++;
+    *execTime = 0;
+    return SIMPID0 + slot;
+}
+
+static pid_t simReap(int *status) {
+    if (simQHead == simQTail) return 0;
+    simEvent e = simQueue[simQHead++ % simQCap];
+    // like the kernel, a PID becomes reusable only once its exit has been collected
+    if (e.status != 0xffff && (e.status & 0xff) != 0x7f) simFree[simFreeCount++] = e.pid - SIMPID0;
+    *status = e.status;
+    return e.pid;
+}
+
+// moves the clock to now, exiting every running process whose lifetime ends by then
+static void simAdvance(uint64_t now) {
+    while (simHeapLen > 0 && simHeap[0].at <= now) {
+        simTimer t = simHeapPop();
+        simProc *p = &simProcs[t.slot];
+        if (t.gen != p->gen || !p->alive || p->stopped) continue; // stopped, killed or reused since
+        if (t.at > simClock) simClock = t.at;
+        simPost(t.slot, p->code << 8);
+    }
+    if (now > simClock) simClock = now;
+    if (simQHead != simQTail) reapPending = true;
+}
+
+// a wait with nothing ready skips the clock ahead to the next exit
+static bool simIdle() {
+    while (simHeapLen > 0 && simQHead == simQTail) simAdvance(simHeap[0].at);
+    if (simQHead == simQTail) return false;
+    reapPending = true;
+    return true;
+}
+
+static int simSignal(pid_t pid, int sig) {
+    int slot = simSlot(pid < 0 ? -pid : pid);
+    if (slot < 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    simProc *p = &simProcs[slot];
+    switch (sig) {
+        case 0: case SIGCHLD: case SIGWINCH: case SIGURG:
+            break;
+        case SIGSTOP: case SIGTSTP: case SIGTTIN: case SIGTTOU:
+            if (p->stopped) break;
+            p->stopped = true;
+            p->left = p->exitAt > simClock ? p->exitAt - simClock : 0;
+            p->gen++;
+            simPost(slot, (sig << 8) | 0x7f);
+            break;
+        case SIGCONT:
+            if (!p->stopped) break;
+            p->stopped = false;
+            p->exitAt = simClock + p->left;
+            simHeapPush(p->exitAt, slot);
+            simPost(slot, 0xffff);
+            break;
+        default:
+            simPost(slot, sig == SIGQUIT || sig == SIGSEGV || sig == SIGABRT ? sig | 0x80 : sig);
+            break;
+    }
+    reapPending = true;
+    return 0;
+}
+
+static const backend simBackend = { simSpawn, simReap, simSignal, simIdle };
+
+// prewarm: launch counts per resolved binary, so the hottest binaries and the libraries
+// they link can be pulled into the page cache before they are needed. Off unless crash is
+// started with --prewarm[=N], which also keeps the counts across sessions, or prewarm --top=N
+// turns it on for this one.
+#define PREWARMMAX 256      // binaries tracked; the least launched makes room, the stalest of equals
+#define PREWARMTOP 8        // binaries kept warm under a bare --prewarm
+#define PREWARMCHECK 60     // seconds between checks of whether the hot set was evicted
+#define HOTSLOTS 1024       // hash slots for binaries by path, and for names as typed; a power of two
+
+typedef struct {
+    char *path;             // resolved through PATH; the key
+    unsigned long launches;
+    unsigned long lastLaunch; // prewarmClock at its latest launch
+    char **libs;            // resolved DT_NEEDED libraries, NULL until first warmed
+    int nLibs;
+} hotBinary;
+
+typedef struct {
+    char *key;              // NULL for an empty slot
+    hotBinary *val;         // in hotByName, NULL for a name that resolves to nothing
+} hotSlot;
+
+static hotBinary *hot[PREWARMMAX];
+static int hotCount = 0;
+static hotSlot hotByPath[HOTSLOTS]; // keys are the binaries' own paths
+static hotSlot hotByName[HOTSLOTS]; // what each bare command name resolved to
+static int namesCached = 0;
+static char *namesPath = NULL;      // the PATH hotByName was resolved under
+static unsigned long prewarmClock = 0;
+static int prewarmTop = 0;  // how many of the hottest binaries to keep warm, 0 for none
+static bool prewarmSaving = false; // --prewarm: counts come from and go back to ~/.crash_prewarm
+static time_t prewarmChecked = 0;
+static unsigned long prewarmRuns = 0, prewarmFiles = 0;
+
+// what execvp() would run for name, or NULL
+static char *resolveCommand(const char *name) {
+    if (strchr(name, '/')) return access(name, X_OK) == 0 ? realpath(name, NULL) : NULL;
+    const char *dirs = getenv("PATH");
+    char candidate[PATH_MAX];
+    for (const char *dir = dirs ? dirs : "/usr/local/bin:/usr/bin:/bin"; *dir; ) {
+        size_t len = strcspn(dir, ":");
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, len ? dir : ".", name);
+        if (access(candidate, X_OK) == 0) return realpath(candidate, NULL);
+        dir += len + (dir[len] == ':');
+    }
+    return NULL;
+}
+
+static const char *libDirs[] = {
+    "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64", "/usr/lib64", "/lib", "/usr/lib",
+    "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu",
+};
+
+static char *resolveLibrary(const char *name, const char *runpath) {
+    char candidate[PATH_MAX];
+    const char *lists[2] = { runpath, getenv("LD_LIBRARY_PATH") };
+    for (int l = 0; l < 2; l++) {
+        for (const char *dir = lists[l]; dir && *dir; ) {
+            size_t len = strcspn(dir, ":");
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, dir, name);
+            if (len && dir[0] != '$' && access(candidate, R_OK) == 0) return strdup(candidate);
+            dir += len + (dir[len] == ':');
+        }
+    }
+    for (size_t i = 0; i < sizeof(libDirs) / sizeof(libDirs[0]); i++) {
+        snprintf(candidate, sizeof(candidate), "%s/%s", libDirs[i], name);
+        if (access(candidate, R_OK) == 0) return strdup(candidate);
+    }
+    return NULL;
+}
+
+// file offset of a virtual address, through the PT_LOAD segments; 0 if unmapped
+static size_t elfOffset(const Elf64_Phdr *ph, int n, Elf64_Addr addr) {
+    for (int i = 0; i < n; i++) {
+        if (ph[i].p_type == PT_LOAD && addr >= ph[i].p_vaddr && addr < ph[i].p_vaddr + ph[i].p_filesz) {
+            return addr - ph[i].p_vaddr + ph[i].p_offset;
+        }
+    }
+    return 0;
+}
+
+// fills b->libs from the DT_NEEDED entries of a 64-bit ELF; anything else has none
+static void resolveLibs(hotBinary *b) {
+    b->libs = calloc(1, sizeof(char *));
+    b->nLibs = 0;
+    int fd = open(b->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Elf64_Ehdr)) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    const unsigned char *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) return;
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)file;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf64_Phdr) > size) {
+        munmap((void *)file, size);
+        return;
+    }
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)(file + eh->e_phoff);
+    const Elf64_Dyn *dyn = NULL;
+    size_t nDyn = 0;
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_DYNAMIC && ph[i].p_offset + ph[i].p_filesz <= size) {
+            dyn = (const Elf64_Dyn *)(file + ph[i].p_offset);
+            nDyn = ph[i].p_filesz / sizeof(*dyn);
+        }
+    }
+    size_t strtab = 0, runpath = 0;
+    bool hasRunpath = false;
+    for (size_t i = 0; i < nDyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_STRTAB) strtab = elfOffset(ph, eh->e_phnum, dyn[i].d_un.d_ptr);
+        if (dyn[i].d_tag == DT_RUNPATH || dyn[i].d_tag == DT_RPATH) {
+            runpath = dyn[i].d_un.d_val;
+            hasRunpath = true;
+        }
+    }
+    if (strtab == 0 || strtab >= size) {
+        munmap((void *)file, size);
+        return;
+    }
+    // strings are only trusted if they end inside the file
+    const char *strings = (const char *)file + strtab;
+    size_t room = size - strtab;
+    const char *rp = hasRunpath && runpath < room && memchr(strings + runpath, '\0', room - runpath)
+                     ? strings + runpath : NULL;
+    for (size_t i = 0; i < nDyn && dyn[i].d_tag != DT_NULL; i++) {
+        size_t at = dyn[i].d_un.d_val;
+        if (dyn[i].d_tag != DT_NEEDED || at >= room || !memchr(strings + at, '\0', room - at)) continue;
+        char *lib = resolveLibrary(strings + at, rp);
+        if (lib == NULL) continue;
+        b->libs = realloc(b->libs, (b->nLibs + 2) * sizeof(char *));
+        b->libs[b->nLibs++] = lib;
+        b->libs[b->nLibs] = NULL;
+    }
+    munmap((void *)file, size);
+}
+
+// asks the kernel to start reading a whole file in; does not wait for the I/O
+static void warmFile(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+    prewarmFiles++;
+}
+
+// percentage of a file's pages in the page cache, or -1 if it cannot be told
+static int residency(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    size_t page = sysconf(_SC_PAGESIZE), pages = (st.st_size + page - 1) / page, in = 0;
+    unsigned char *vec = malloc(pages);
+    if (vec && mincore(map, st.st_size, vec) == 0) {
+        for (size_t i = 0; i < pages; i++) in += vec[i] & 1;
+    } else {
+        in = pages + 1;
+    }
+    free(vec);
+    munmap(map, st.st_size);
+    return in > pages ? -1 : (int)(in * 100 / pages);
+}
+
+static int hotCmp(const void *a, const void *b) {
+    const hotBinary *x = *(hotBinary *const *)a, *y = *(hotBinary *const *)b;
+    return (y->launches > x->launches) - (y->launches < x->launches);
+}
+
+static int hotAgeCmp(const void *a, const void *b) {
+    const hotBinary *x = *(hotBinary *const *)a, *y = *(hotBinary *const *)b;
+    return (x->lastLaunch > y->lastLaunch) - (x->lastLaunch < y->lastLaunch);
+}
+
+// warms the hottest prewarmTop binaries and their libraries; with evictedOnly, just the
+// ones that have mostly dropped out of the page cache
+static void prewarmHot(bool evictedOnly) {
+    qsort(hot, hotCount, sizeof(*hot), hotCmp);
+    for (int i = 0; i < hotCount && i < prewarmTop; i++) {
+        int resident = evictedOnly ? residency(hot[i]->path) : 0;
+        if (resident >= 50) continue;
+        if (hot[i]->libs == NULL) resolveLibs(hot[i]);
+        warmFile(hot[i]->path);
+        for (int l = 0; l < hot[i]->nLibs; l++) warmFile(hot[i]->libs[l]);
+    }
+    prewarmRuns++;
+    prewarmChecked = time(NULL);
+}
+
+static size_t hotSlotOf(const char *key) {
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (; *key; key++) h = (h ^ (unsigned char)*key) * 1099511628211ull;
+    return h & (HOTSLOTS - 1);
+}
+
+// key's slot, or the empty one it would go in
+static hotSlot *hotFind(hotSlot *table, const char *key) {
+    size_t i = hotSlotOf(key);
+    while (table[i].key != NULL && strcmp(table[i].key, key) != 0) i = (i + 1) & (HOTSLOTS - 1);
+    return &table[i];
+}
+
+// as tableRemove(), shifting later members of the probe chain back into the hole
+static void hotRemove(hotSlot *table, const char *key) {
+    size_t i = hotFind(table, key) - table, j = i;
+    if (table[i].key == NULL) return;
+    for (;;) {
+        table[i].key = NULL;
+        for (;;) {
+            j = (j + 1) & (HOTSLOTS - 1);
+            if (table[j].key == NULL) return;
+            size_t home = hotSlotOf(table[j].key);
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+            break;
+        }
+        table[i] = table[j];
+        i = j;
+    }
+}
+
+static void hotForgetNames() {
+    for (int i = 0; i < HOTSLOTS; i++) {
+        free(hotByName[i].key);
+        hotByName[i].key = NULL;
+    }
+    namesCached = 0;
+}
+
+// the entry for an already resolved path, made if need be; takes path over
+static hotBinary *hotAdd(char *path) {
+    hotSlot *s = hotFind(hotByPath, path);
+    if (s->key != NULL) { // another name for a binary already tracked
+        free(path);
+        return s->val;
+    }
+    if (hotCount == PREWARMMAX) {
+        int lru = 0;
+        for (int i = 1; i < hotCount; i++) {
+            if (hot[i]->launches < hot[lru]->launches ||
+                (hot[i]->launches == hot[lru]->launches && hot[i]->lastLaunch < hot[lru]->lastLaunch)) lru = i;
+        }
+        hotBinary *old = hot[lru];
+        hotRemove(hotByPath, old->path);
+        hotForgetNames(); // some may resolve to it
+        free(old->path);
+        for (int l = 0; l < old->nLibs; l++) free(old->libs[l]);
+        free(old->libs);
+        free(old);
+        hot[lru] = hot[--hotCount];
+        s = hotFind(hotByPath, path);
+    }
+    hotBinary *b = calloc(1, sizeof(*b));
+    b->path = path;
+    b->lastLaunch = ++prewarmClock;
+    hot[hotCount++] = b;
+    s->key = b->path;
+    s->val = b;
+    return b;
+}
+
+// what a bare command name runs, through hotByName; NULL if nothing on PATH
+static hotBinary *hotLookup(const char *name) {
+    const char *pathVar = getenv("PATH");
+    if (pathVar == NULL) pathVar = "";
+    if (namesPath == NULL || strcmp(namesPath, pathVar) != 0) {
+        hotForgetNames();
+        free(namesPath);
+        namesPath = strdup(pathVar);
+    }
+    hotSlot *s = hotFind(hotByName, name);
+    if (s->key != NULL) return s->val;
+    char *path = resolveCommand(name);
+    hotBinary *b = path ? hotAdd(path) : NULL;
+    // hotAdd() may have emptied the table; a full one is emptied here
+    if (namesCached >= HOTSLOTS / 2) hotForgetNames();
+    s = hotFind(hotByName, name);
+    s->key = strdup(name);
+    s->val = b;
+    namesCached++;
+    return b;
+}
+
+// counts a launch of an external command, and now and then rewarms what was evicted
+static void prewarmNote(const char *name) {
+    if (prewarmTop == 0) return;
+    hotBinary *b;
+    if (strchr(name, '/')) { // relative to the directory, so not cached
+        char *path = resolveCommand(name);
+        b = path ? hotAdd(path) : NULL;
+    } else {
+        b = hotLookup(name);
+    }
+    if (b) {
+        b->launches++;
+        b->lastLaunch = ++prewarmClock;
+    }
+    if (time(NULL) - prewarmChecked >= PREWARMCHECK) {
+        hotForgetNames(); // names that resolved to nothing may resolve now
+        prewarmHot(true);
+    }
+}
+
+static char *prewarmFile() {
+    static char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    if (home == NULL) return NULL;
+    snprintf(path, sizeof(path), "%s/.crash_prewarm", home);
+    return path;
+}
+
+// least recently launched first, so loading the file back keeps the eviction order
+static void prewarmSave() {
+    char *path = prewarmFile();
+    if (!prewarmSaving || path == NULL || hotCount == 0) return;
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return;
+    qsort(hot, hotCount, sizeof(*hot), hotAgeCmp);
+    for (int i = 0; i < hotCount; i++) fprintf(f, "%lu %s\n", hot[i]->launches, hot[i]->path);
+    fclose(f);
+}
+
+#ifndef CRASH_LIBRARY
+// --prewarm=top: picks up the counts of earlier sessions, warms the hottest at once and
+// saves the counts at exit
+static void prewarmLoad(int top) {
+    char *path = prewarmFile();
+    FILE *f = path ? fopen(path, "r") : NULL;
+    prewarmTop = top;
+    prewarmSaving = true;
+    atexit(prewarmSave);
+    if (f == NULL) return;
+    char line[MAXLINE + 2 * PATH_MAX], first[PATH_MAX], second[PATH_MAX];
+    unsigned long launches;
+    while (fgets(line, sizeof(line), f)) {
+        // older files have the name as typed before the path
+        int n = sscanf(line, "%lu %4095s %4095s", &launches, first, second);
+        if (n >= 2) hotAdd(strdup(n == 3 ? second : first))->launches += launches;
+    }
+    fclose(f);
+    if (prewarmTop > 0) prewarmHot(false);
+}
+#endif
+
+// prewarm [now | --top=N]; lists tracked binaries by launch count, with how much of each
+// is in the page cache. now warms the hottest N at once; --top=N with N above 0 starts
+// counting launches, and --top=0 stops.
+static int prewarm(const char **toks, bool bg) {
+    if (toks[1] != NULL && toks[2] == NULL && strcmp(toks[1], "now") == 0) {
+        prewarmHot(false);
+        return 0;
+    }
+    if (toks[1] != NULL) {
+        char *end = NULL;
+        long top = strncmp(toks[1], "--top=", 6) == 0 ? strtol(toks[1] + 6, &end, 10) : -1;
+        if (toks[2] != NULL || end == NULL || *end != '\0' || top < 0 || top > PREWARMMAX) {
+            error("ERROR: bad argument for prewarm: %s\n", toks[1]);
+            return 1;
+        }
+        prewarmTop = top;
+        return 0;
+    }
+    qsort(hot, hotCount, sizeof(*hot), hotCmp);
+    out("top %d, %lu passes, %lu files warmed\n", prewarmTop, prewarmRuns, prewarmFiles);
+    for (int i = 0; i < hotCount; i++) {
+        int resident = residency(hot[i]->path);
+        out("%c %6lu  ", i < prewarmTop ? '*' : ' ', hot[i]->launches);
+        if (resident < 0) out("   ?  %s", hot[i]->path);
+        else out("%3d%%  %s", resident, hot[i]->path);
+        if (hot[i]->libs) out("  (+%d libraries)", hot[i]->nLibs);
+        out("\n");
+    }
+    return 0;
+}
+
+// launch governor: a token bucket for forks plus an optional brake on load or CPU pressure.
+// A throttled launch from the command line waits, keeping the event loop running, instead
+// of failing. Launches the reaper or a timer makes (dag nodes, every and repeat runs) must
+// not wait there, so they are queued and retried from the governor's timer.
+#define BRAKESTEP 0.1 // seconds between pressure checks while braked
+#define GOV_BRAKE 1   // governorReady(): held back by load or pressure
+#define GOV_RATE 2    // governorReady(): out of tokens
+
+static double govRate = 0;    // launches per second, 0 for no limit
+static double govBurst = 1;   // bucket size
+static double govTokens = 1;
+static uint64_t govLast = 0;  // when govTokens was last topped up
+static double govLoad = 0;    // brake while the 1-minute load average is above this, 0 for off
+static double govPsi = 0;     // brake while CPU "some" avg10 pressure is above this, 0 for off
+static unsigned long govThrottled = 0, govBraked = 0;
+static uint64_t govDelay = 0; // microseconds spent waiting, all told
+static int govTimer = -1;     // fires when queued launches may be retried
+static uint64_t govQueued = 0; // when launches started queueing, 0 if none are
+static unsigned long govDeferred = 0; // refusals queued, so governorTick() sees if any recur
+static bool launchAdmitted = false; // the next spawnJob() already has its token
+
+// "some avg10" from a /proc/pressure file, -1 if unavailable
+static double pressureAvg(const char *path) {
+    char buf[256];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *avg = strstr(buf, "avg10=");
+    return avg ? strtod(avg + 6, NULL) : -1;
+}
+
+static bool braking() {
+    double load;
+    if (govLoad > 0 && getloadavg(&load, 1) == 1 && load > govLoad) return true;
+    return govPsi > 0 && pressureAvg("/proc/pressure/cpu") > govPsi;
+}
+
+// takes a token and returns 0 if a launch may go now; otherwise returns why not, with
+// *wait set to the microseconds until it is worth asking again. Never blocks.
+static int governorReady(uint64_t *wait) {
+    if (govRate <= 0 && govLoad <= 0 && govPsi <= 0) return 0;
+    if (braking()) {
+        *wait = BRAKESTEP * 1e6;
+        return GOV_BRAKE;
+    }
+    if (govRate > 0) {
+        uint64_t now = traceNow();
+        govTokens += (now - govLast) / 1e6 * govRate;
+        if (govTokens > govBurst) govTokens = govBurst;
+        govLast = now;
+        if (govTokens < 1) {
+            *wait = (1 - govTokens) / govRate * 1e6 + 1;
+            return GOV_RATE;
+        }
+        govTokens -= 1;
+    }
+    return 0;
+}
+
+// called before every fork from the command line; false if a keyboard signal arrived while waiting
+static bool governorAdmit() {
+    uint64_t start = traceNow(), wait;
+    bool braked = false, throttled = false;
+    int why;
+    while ((why = governorReady(&wait)) != 0) {
+        braked |= why == GOV_BRAKE;
+        throttled |= why == GOV_RATE;
+        if (!pauseShell(wait / 1e6)) return false;
+    }
+    govBraked += braked;
+    govThrottled += throttled;
+    govDelay += traceNow() - start;
+    return true;
+}
+
+static void governorArm(uint64_t wait) {
+    struct itimerspec when = { .it_value = { wait / 1000000, wait % 1000000 * 1000 } };
+    timerfd_settime(govTimer, 0, &when, NULL);
+}
+
+// a launch that must not wait was refused for why; governorTick() retries it after wait
+static void governorDefer(int why, uint64_t wait) {
+    govDeferred++;
+    if (govQueued == 0) {
+        govQueued = traceNow();
+        if (why == GOV_BRAKE) govBraked++;
+        else govThrottled++;
+    }
+    governorArm(wait > 0 ? wait : 1);
+}
+
+// /proc/PID files held open from spawn to reap, so jtop samples a job with one pread per
+// file and no path lookups. Past half the descriptor limit, jtop opens them as it goes.
+#define PROC_STAT 0
+#define PROC_STATM 1
+#define PROC_IO 2
+#define NPROCFILES 3
+
+static const char *const procFiles[NPROCFILES] = { "stat", "statm", "io" };
+static long procFdsHeld = 0, procFdBudget = -1;
+
+// jtop holds three descriptors per job, so crash takes the hard limit; jobs get the old one back
+static void raiseNofile() {
+    struct rlimit r;
+    if (getrlimit(RLIMIT_NOFILE, &r) < 0 || r.rlim_cur == r.rlim_max) return;
+    shellNofile = r;
+    r.rlim_cur = r.rlim_max;
+    nofileRaised = setrlimit(RLIMIT_NOFILE, &r) == 0;
+}
+
+static int procOpenFile(pid_t pid, int file) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, procFiles[file]);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void procOpen(job *j) {
+    if (procFdBudget < 0) {
+        struct rlimit r;
+        getrlimit(RLIMIT_NOFILE, &r);
+        procFdBudget = r.rlim_cur == RLIM_INFINITY ? (long)MAXJOBS * NPROCFILES : (long)r.rlim_cur / 2;
+    }
+    for (int i = 0; i < NPROCFILES; i++) {
+        j->procFd[i] = -1;
+        // the simulator's PIDs are made up
+        if (sys != &osBackend || procFdsHeld >= procFdBudget) continue;
+        if ((j->procFd[i] = procOpenFile(j->PID, i)) >= 0) procFdsHeld++;
+    }
+    j->cpuTicks = 0;
+    j->sampledAt = 0;
+}
+
+static void procClose(job *j) {
+    for (int i = 0; i < NPROCFILES; i++) {
+        if (j->procFd[i] < 0) continue;
+        close(j->procFd[i]);
+        procFdsHeld--;
+    }
+}
+
+// adds a running process to the job table under the next job number
+static job *registerJob(pid_t pid, const char *name) {
+    size_t nameLen = strlen(name) + 1;
+    job *newJob = malloc(sizeof(job) + nameLen);
+    newJob->PID = pid;
+    newJob->jobNum = currJob++;
+    newJob->status = RUNNING;
+    newJob->dagNode = NULL;
+    newJob->sched = NULL;
+    newJob->limited = 0;
+    newJob->sclass = CLASS_DEFAULT;
+    newJob->pressured = 0;
+    for (int i = 0; i < NLIMITS; i++) {
+        if (launchLimits->max[i] != RLIM_INFINITY) newJob->limited |= 1 << i;
+    }
+    memcpy(newJob->name, name, nameLen);
+    procOpen(newJob);
+    tableInsert(numTable, newJob->jobNum, newJob);
+    tableInsert(pidTable, pid, newJob);
+    liveInsert(newJob);
+    liveCount++;
+    return newJob;
+}
+
+// forks and registers a new job; toks is NULL-terminated and handed to exec as is.
+// With inChild set, the forked child runs that builtin instead of exec'ing. With bg set,
+// it starts in the background class and, under --tag or --buffer, its output is relayed
+// through the shell. With launchTee set, its output is relayed whatever the mode, and if
+// the job starts its streams take over the two descriptors to copy it into. launchTee and
+// launchLimits apply to this job alone: they are taken and reset on entry, so nothing
+// started while this call waits for the governor, or while the job runs in front, gets them.
+static job *spawnJob(const char **toks, const builtin *inChild, bool bg) {
+    const char *process = toks[0];
+    bool admitted = launchAdmitted;
+    const jobLimits *limits = launchLimits;
+    const int *tee = launchTee;
+    launchAdmitted = false;
+    launchLimits = &limitDefaults;
+    launchTee = NULL;
+    if (liveCount >= MAXJOBS) {
+        error("ERROR: too many jobs\n");
+        return NULL;
+    }
+    if (!admitted && !governorAdmit()) return NULL;
+    if (inChild == NULL && sys == &osBackend) prewarmNote(process);
+    flushOut();
+    uint64_t start = TRACE_START(), execTime = 0;
+    int readEnds[2], writeEnds[2];
+    bool capture = (bg && outMode != OUT_DIRECT) || tee != NULL;
+    launchClass = bg ? bgClass : CLASS_NORMAL;
+    if (capture && !streamPipes(readEnds, writeEnds)) {
+        error("ERROR: cannot run %s\n", process);
+        return NULL;
+    }
+    launchLimits = limits; // for the fork and registerJob() only; neither runs the event loop
+    pid_t child = sys->spawn(toks, inChild, capture ? writeEnds : NULL, &execTime);
+    if (capture) {
+        close(writeEnds[0]);
+        close(writeEnds[1]);
+        if (child < 0) {
+            close(readEnds[0]);
+            close(readEnds[1]);
+        } else {
+            streamAdd(readEnds[0], currJob, STDOUT_FILENO, tee ? tee[0] : -1);
+            streamAdd(readEnds[1], currJob, STDERR_FILENO, tee ? tee[1] : -1);
+        }
+    }
+    if (child < 0) {
+        launchLimits = &limitDefaults;
+        error("ERROR: cannot run %s\n", process);
+        return NULL;
+    }
+
+    job *childJob = registerJob(child, process);
+    launchLimits = &limitDefaults;
+    TRACE('X', "fork", start, childJob->jobNum, child, 0, process);
+    if (execTime) TRACE('i', "exec", execTime, childJob->jobNum, child, 0, process);
+    return childJob;
+}
+
+static int runProcess(const char **toks, bool bg, const builtin *inChild) {
+    job *childJob = spawnJob(toks, inChild, bg);
+    if (childJob == NULL) return 1;
+    if (!bg) { //if foreground, wait for death
+        waitForeground(childJob);
+        return fgStatus;
+    }
+    printJob(childJob);
+    return 0;
+}
+
+static int trueBuiltin(const char **toks, bool bg) {
+    return 0;
+}
+
+static int falseBuiltin(const char **toks, bool bg) {
+    return 1;
+}
+
+static int echo(const char **toks, bool bg) {
+    int i = 1;
+    bool newline = true;
+    if (toks[1] != NULL && strcmp(toks[1], "-n") == 0) {
+        newline = false;
+        i++;
+    }
+    for (int first = i; toks[i] != NULL; i++) {
+        if (i > first) outWrite(" ", 1);
+        outWrite(toks[i], strlen(toks[i]));
+    }
+    if (newline) outWrite("\n", 1);
+    return 0;
+}
+
+// writes len bytes of s, expanding printf's backslash escapes
+static void printEscaped(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '\\' && i + 1 < len) {
+            switch (s[++i]) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'a': c = '\a'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'v': c = '\v'; break;
+                case '\\': c = '\\'; break;
+                default: outWrite(s + i - 1, 1); c = s[i];
+            }
+        }
+        outWrite(&c, 1);
+    }
+}
+
+static long long printfNumber(const char *arg, int *status) {
+    if (arg == NULL) return 0;
+    if (arg[0] == '\'' || arg[0] == '"') return (unsigned char)arg[1];
+    char *end;
+    errno = 0;
+    long long n = strtoll(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0' || errno != 0) {
+        error("ERROR: bad argument for printf: %s\n", arg);
+        *status = 1;
+    }
+    return n;
+}
+
+// POSIX printf: the format is reused until every argument has been consumed
+static int printfBuiltin(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        error("ERROR: printf needs some arguments\n");
+        return 1;
+    }
+    const char *format = toks[1];
+    const char **arg = toks + 2;
+    int status = 0;
+    do {
+        const char **passStart = arg;
+        const char *f = format;
+        while (*f) {
+            const char *lit = f;
+            while (*f && *f != '%') f++;
+            printEscaped(lit, f - lit);
+            if (!*f) break;
+
+            const char *spec = f++;
+            while (*f && strchr("-+ #0", *f)) f++;
+            while (*f >= '0' && *f <= '9') f++;
+            if (*f == '.') {
+                f++;
+                while (*f >= '0' && *f <= '9') f++;
+            }
+            char conv = *f;
+            if (conv == '\0') {
+                outWrite(spec, f - spec);
+                break;
+            }
+            f++;
+            if (conv == '%') {
+                outWrite("%", 1);
+                continue;
+            }
+
+            char fmt[64];
+            size_t specLen = f - spec - 1;
+            if (specLen > sizeof(fmt) - 4) specLen = sizeof(fmt) - 4;
+            memcpy(fmt, spec, specLen);
+            const char *a = *arg ? *arg++ : NULL;
+            char *buf = NULL;
+            int n = -1;
+            switch (conv) {
+                case 'd': case 'i':
+                    strcpy(fmt + specLen, "lld");
+                    n = asprintf(&buf, fmt, printfNumber(a, &status));
+                    break;
+                case 'u': case 'x': case 'X': case 'o':
+                    fmt[specLen] = 'l';
+                    fmt[specLen + 1] = 'l';
+                    fmt[specLen + 2] = conv;
+                    fmt[specLen + 3] = '\0';
+                    n = asprintf(&buf, fmt, (unsigned long long)printfNumber(a, &status));
+                    break;
+                case 'f': case 'e': case 'g': case 'E': case 'G':
+                    fmt[specLen] = conv;
+                    fmt[specLen + 1] = '\0';
+                    n = asprintf(&buf, fmt, a ? strtod(a, NULL) : 0.0);
+                    break;
+                case 'c':
+                    strcpy(fmt + specLen, "c");
+                    n = asprintf(&buf, fmt, a ? a[0] : '\0');
+                    break;
+                case 'b':
+                    if (a) printEscaped(a, strlen(a));
+                    break;
+                case 's':
+                    strcpy(fmt + specLen, "s");
+                    n = asprintf(&buf, fmt, a ? a : "");
+                    break;
+                default:
+                    error("ERROR: bad argument for printf: %s\n", format);
+                    return 1;
+            }
+            if (n > 0) outWrite(buf, n);
+            free(buf);
+        }
+        if (arg == passStart) break; // format consumed nothing, so stop reusing it
+    } while (*arg != NULL);
+    return status;
+}
+
+static const struct {
+    const char *name;
+    int sig;
+} sigNames[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "ABRT", SIGABRT },
+    { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "SEGV", SIGSEGV }, { "USR2", SIGUSR2 },
+    { "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CHLD", SIGCHLD },
+    { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN },
+    { "TTOU", SIGTTOU }, { "XCPU", SIGXCPU }, { "XFSZ", SIGXFSZ }, { "WINCH", SIGWINCH },
+};
+
+static int signalNumber(const char *name) {
+    if (strncmp(name, "SIG", 3) == 0) name += 3;
+    char *end;
+    long n = strtol(name, &end, 10);
+    if (*name != '\0' && *end == '\0') return n > 0 && n < NSIG ? n : -1;
+    for (size_t i = 0; i < sizeof(sigNames) / sizeof(sigNames[0]); i++) {
+        if (strcmp(name, sigNames[i].name) == 0) return sigNames[i].sig;
+    }
+    return -1;
+}
+
+// kill [-SIG | -s SIG] (PID | %job)...; %job signals the job's whole process group
+static int killBuiltin(const char **toks, bool bg) {
+    int sig = SIGTERM;
+    int i = 1;
+    if (toks[i] != NULL && strcmp(toks[i], "-s") == 0 && toks[i + 1] != NULL) {
+        sig = signalNumber(toks[i + 1]);
+        i += 2;
+    } else if (toks[i] != NULL && toks[i][0] == '-' && toks[i][1] != '\0') {
+        sig = signalNumber(toks[i] + 1);
+        i++;
+    }
+    if (sig < 0) {
+        error("ERROR: bad argument for kill: %s\n", toks[i - 1]);
+        return 1;
+    }
+    if (toks[i] == NULL) {
+        error("ERROR: kill needs some arguments\n");
+        return 1;
+    }
+    int status = 0;
+    for (; toks[i] != NULL; i++) {
+        if (toks[i][0] == '%') {
+            job *target = lookupArg("kill", toks[i]);
+            if (!target || sys->signal(-target->PID, sig) < 0) status = 1;
+            continue;
+        }
+        char *end;
+        long pid = strtol(toks[i], &end, 10);
+        if (toks[i][0] == '\0' || *end != '\0') {
+            error("ERROR: bad argument for kill: %s\n", toks[i]);
+            status = 1;
+        } else if (sys->signal(pid, sig) < 0) {
+            error("ERROR: no PID %ld\n", pid);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// sleep DURATION...; durations are seconds with optional s/m/h/d suffixes and are summed.
+// With keyboard signals on it runs as a job, so Ctrl+C, Ctrl+\ and Ctrl+Z act on it as
+// on an external sleep; otherwise it runs in the shell itself.
+static int sleepBuiltin(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        error("ERROR: sleep needs some arguments\n");
+        return 1;
+    }
+    double total = 0;
+    for (int i = 1; toks[i] != NULL; i++) {
+        char *end;
+        double secs = strtod(toks[i], &end);
+        double scale = 1;
+        switch (*end) {
+            case 'd': scale *= 24; // fall through
+            case 'h': scale *= 60; // fall through
+            case 'm': scale *= 60; // fall through
+            case 's': end++;
+        }
+        if (end == toks[i] || *end != '\0' || secs < 0) {
+            error("ERROR: bad argument for sleep: %s\n", toks[i]);
+            return 1;
+        }
+        total += secs * scale;
+    }
+
+    return pauseShell(total) ? 0 : 128 + interrupted;
+}
+
+static int fileTest(char op, const char *path) {
+    struct stat st;
+    if (op == 'L' || op == 'h') return lstat(path, &st) == 0 && S_ISLNK(st.st_mode);
+    if (stat(path, &st) != 0) return false;
+    switch (op) {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'r': return access(path, R_OK) == 0;
+        case 'w': return access(path, W_OK) == 0;
+        case 'x': return access(path, X_OK) == 0;
+    }
+    return -1;
+}
+
+static bool testInteger(const char *s, long long *n) {
+    char *end;
+    errno = 0;
+    *n = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno != 0) {
+        error("ERROR: bad argument for test: %s\n", s);
+        return false;
+    }
+    return true;
+}
+
+// returns 1 for true, 0 for false and -1 on a syntax error, following POSIX's rules by argument count
+static int testExpr(const char **a, int n) {
+    if (n == 0) return 0;
+    if (n == 1) return a[0][0] != '\0';
+    if (strcmp(a[0], "!") == 0 && n <= 4) {
+        int r = testExpr(a + 1, n - 1);
+        return r < 0 ? r : !r;
+    }
+    if (n == 2) {
+        if (a[0][0] != '-' || a[0][1] == '\0' || a[0][2] != '\0') return -1;
+        if (a[0][1] == 'n') return a[1][0] != '\0';
+        if (a[0][1] == 'z') return a[1][0] == '\0';
+        if (a[0][1] == 't') return isatty(atoi(a[1]));
+        return fileTest(a[0][1], a[1]);
+    }
+    if (n == 3) {
+        const char *op = a[1];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a[0], a[2]) == 0;
+        if (strcmp(op, "!=") == 0) return strcmp(a[0], a[2]) != 0;
+        static const char *intOps[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+        for (int i = 0; i < 6; i++) {
+            if (strcmp(op, intOps[i]) != 0) continue;
+            long long l, r;
+            if (!testInteger(a[0], &l) || !testInteger(a[2], &r)) return -1;
+            switch (i) {
+                case 0: return l == r;
+                case 1: return l != r;
+                case 2: return l < r;
+                case 3: return l <= r;
+                case 4: return l > r;
+                default: return l >= r;
+            }
+        }
+    }
+    return -1;
+}
+
+static int testBuiltin(const char **toks, bool bg) {
+    int n = 0;
+    while (toks[n + 1] != NULL) n++;
+    if (strcmp(toks[0], "[") == 0) {
+        if (n == 0 || strcmp(toks[n], "]") != 0) {
+            error("ERROR: [ needs a closing ]\n");
+            return 2;
+        }
+        n--;
+    }
+    int r = testExpr(toks + 1, n);
+    if (r < 0) {
+        error("ERROR: bad argument for %s: %s\n", toks[0], n > 0 ? toks[1] : "");
+        return 2;
+    }
+    return !r;
+}
+
+// mem: the heap, RSS and open file figures that should stay flat however many jobs have
+// come and gone
+static int mem(const char **toks, bool bg) {
+    if (toks[1] != NULL) {
+        error("ERROR: mem takes no arguments\n");
+        return 1;
+    }
+    struct mallinfo2 heap = mallinfo2();
+    long pages = 0, rss = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &rss) != 2) rss = 0;
+        fclose(statm);
+    }
+    int fds = 0;
+    DIR *fdDir = opendir("/proc/self/fd");
+    if (fdDir) {
+        while (readdir(fdDir)) fds++;
+        fds -= 3; // ., .. and fdDir itself
+        closedir(fdDir);
+    }
+    out("live jobs: %d\n", liveCount);
+    out("heap: %zu bytes in use, %zu arena bytes\n", heap.uordblks, heap.arena + heap.hblkhd);
+    out("rss: %ld kB\n", rss * (sysconf(_SC_PAGESIZE) / 1024));
+    out("fds: %d open\n", fds);
+    return 0;
+}
+
+// trace [flush]: reports or writes out the --trace ring
+static int traceBuiltin(const char **toks, bool bg) {
+    if (!tracing) {
+        error("ERROR: tracing is off; start crash with --trace=FILE\n");
+        return 1;
+    }
+    if (toks[1] != NULL && strcmp(toks[1], "flush") == 0 && toks[2] == NULL) {
+        traceFlush();
+        return 0;
+    }
+    if (toks[1] != NULL) {
+        error("ERROR: bad argument for trace: %s\n", toks[1]);
+        return 1;
+    }
+    uint64_t pending = traceHead - traceFlushed;
+    out("trace: %llu events recorded, %llu pending, %llu dropped\n", (unsigned long long)traceHead,
+        (unsigned long long)(pending > TRACERING ? TRACERING : pending),
+        (unsigned long long)(pending > TRACERING ? pending - TRACERING : 0));
+    return 0;
+}
+
+static bool setSubreaper(bool on) {
+    if (prctl(PR_SET_CHILD_SUBREAPER, on ? 1 : 0, 0, 0, 0) != 0) {
+        error("ERROR: cannot %s subreaper mode\n", on ? "enable" : "disable");
+        return false;
+    }
+    subreaper = on;
+    return true;
+}
+
+// subreaper [on | off]: adopt and quietly reap orphaned descendants of jobs
+static int subreaperBuiltin(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        out("subreaper: %s, %lu orphans reaped\n", subreaper ? "on" : "off", orphansReaped);
+        return 0;
+    }
+    if (toks[2] != NULL || (strcmp(toks[1], "on") != 0 && strcmp(toks[1], "off") != 0)) {
+        error("ERROR: bad argument for subreaper: %s\n", toks[1]);
+        return 1;
+    }
+    return setSubreaper(strcmp(toks[1], "on") == 0) ? 0 : 1;
+}
+
+// checks the job table against itself: the live list is in job-number order, its length
+// is liveCount, and both hash tables hold exactly its jobs
+static bool simCheck() {
+    int n = 0, prev = -1;
+    bool ok = true;
+    for (job *j = liveHead; j; j = j->next, n++) {
+        if (j->jobNum <= prev || (j->prev ? j->prev->next : liveHead) != j) {
+            error("ERROR: sim check: job %d out of order\n", j->jobNum);
+            ok = false;
+        }
+        if (tableGet(numTable, j->jobNum) != j || tableGet(pidTable, j->PID) != j) {
+            error("ERROR: sim check: job %d missing from a table\n", j->jobNum);
+            ok = false;
+        }
+        // with every status collected, the table and the simulator agree on who is alive
+        if (sys == &simBackend && simQHead == simQTail && simSlot(j->PID) < 0) {
+            error("ERROR: sim check: job %d has no process\n", j->jobNum);
+            ok = false;
+        }
+        prev = j->jobNum;
+    }
+    if (n != liveCount || (liveTail && liveTail->next) || (n > 0) != (liveTail != NULL)) {
+        error("ERROR: sim check: %d jobs listed, %d counted\n", n, liveCount);
+        ok = false;
+    }
+    if (ok) out("sim check: ok, %d jobs\n", n);
+    return ok;
+}
+
+// sim [advance MS | life MS | check | exit CODE | stop | cont | signal SIG [PID | %job]...]
+// scripts the simulator; with no targets, exit/stop/cont/signal hit every live job at once
+static int simBuiltin(const char **toks, bool bg) {
+    if (toks[1] != NULL && strcmp(toks[1], "check") == 0) return simCheck() ? 0 : 1;
+    if (sys != &simBackend) {
+        error("ERROR: sim: not simulating (start crash with --sim)\n");
+        return 1;
+    }
+    if (toks[1] == NULL) {
+        out("sim: %llums, %d processes, %zu events queued, %lu spawned, %lu events, life %llums\n",
+            (unsigned long long)simClock, simUsed - simFreeCount, simQTail - simQHead,
+            simSpawned, simEvents, (unsigned long long)simLife);
+        return 0;
+    }
+    const char *cmd = toks[1];
+    char *end;
+    if (strcmp(cmd, "advance") == 0 || strcmp(cmd, "life") == 0) {
+        long long ms = toks[2] ? strtoll(toks[2], &end, 10) : -1;
+        if (toks[2] == NULL || *end != '\0' || ms < 0) {
+            error("ERROR: sim %s needs milliseconds\n", cmd);
+            return 1;
+        }
+        if (cmd[0] == 'l') simLife = ms;
+        else simAdvance(simClock + ms);
+        while (reapPending) handler();
+        return 0;
+    }
+
+    int first = 2, sig = 0, code = -1;
+    if (strcmp(cmd, "exit") == 0 || strcmp(cmd, "signal") == 0) {
+        if (toks[2] == NULL) {
+            error("ERROR: sim %s needs an argument\n", cmd);
+            return 1;
+        }
+        if (cmd[0] == 'e') {
+            code = strtol(toks[2], &end, 10);
+            if (*end != '\0' || code < 0 || code > 255) code = -1;
+        } else {
+            sig = signalNumber(toks[2]);
+        }
+        if (code < 0 && sig <= 0) {
+            error("ERROR: sim %s: bad argument %s\n", cmd, toks[2]);
+            return 1;
+        }
+        first = 3;
+    } else if (strcmp(cmd, "stop") == 0) {
+        sig = SIGSTOP;
+    } else if (strcmp(cmd, "cont") == 0) {
+        sig = SIGCONT;
+    } else {
+        error("ERROR: sim: unknown command %s\n", cmd);
+        return 1;
+    }
+
+    int status = 0;
+    for (job *j = liveHead, *next; toks[first] == NULL && j; j = next) {
+        next = j->next;
+        if (code >= 0) simPost(j->PID - SIMPID0, code << 8);
+        else simSignal(j->PID, sig);
+    }
+    for (int i = first; toks[i] != NULL; i++) {
+        job *target = lookupArg("sim", toks[i]);
+        if (target == NULL) {
+            status = 1;
+        } else if (code >= 0) {
+            if (simSlot(target->PID) >= 0) simPost(target->PID - SIMPID0, code << 8);
+        } else {
+            simSignal(target->PID, sig);
+        }
+    }
+    // deliver now, so a script sees the notifications before its next line runs
+    while (reapPending) handler();
+    return status;
+}
+
+static int sigIndex(int sig) {
+    return sig == SIGINT ? 0 : sig == SIGQUIT ? 1 : 2;
+}
+
+static void latRecord(latency *l, uint64_t us) {
+    if (us > UINT32_MAX) us = UINT32_MAX;
+    l->samples[l->count++ % LATRING] = us;
+    if (us > l->max) l->max = us;
+}
+
+static int u32Cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// prints percentiles over the retained samples; returns the p99, 0 if there are none
+static uint32_t latReport(const latency *l) {
+    size_t n = l->count < LATRING ? l->count : LATRING;
+    if (n == 0) {
+        out("%-8s no samples\n", l->name);
+        return 0;
+    }
+    static uint32_t sorted[LATRING];
+    memcpy(sorted, l->samples, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), u32Cmp);
+    uint32_t p99 = sorted[(n - 1) * 99 / 100];
+    out("%-8s %llu samples, p50 %uus p90 %uus p99 %uus max %uus\n", l->name, (unsigned long long)l->count,
+        sorted[(n - 1) / 2], sorted[(n - 1) * 9 / 10], p99, l->max);
+    return p99;
+}
+
+// sigstat [reset | --max-p99=US]; keyboard signal handling: what the shell did with each,
+// and its own share of the latency, from reading the signal to kill() and from kill() to
+// reporting the stop or death. With --max-p99, fails if either p99 is above US.
+// tests/ptybench times the same path end to end, from the keypress on a terminal.
+static int sigstat(const char **toks, bool bg) {
+    long limit = -1;
+    if (toks[1] != NULL && toks[2] == NULL && strcmp(toks[1], "reset") == 0) {
+        fwdLatency.count = notifyLatency.count = 0;
+        fwdLatency.max = notifyLatency.max = 0;
+        memset(sigForwarded, 0, sizeof(sigForwarded));
+        memset(sigIgnored, 0, sizeof(sigIgnored));
+        return 0;
+    }
+    if (toks[1] != NULL) {
+        char *end;
+        if (strncmp(toks[1], "--max-p99=", 10) == 0) limit = strtol(toks[1] + 10, &end, 10);
+        if (toks[2] != NULL || limit < 0 || *end != '\0') {
+            error("ERROR: bad argument for sigstat: %s\n", toks[1]);
+            return 1;
+        }
+    }
+    uint32_t fwd = latReport(&fwdLatency), notify = latReport(&notifyLatency);
+    out("SIGINT %lu forwarded, %lu ignored; SIGQUIT %lu forwarded; SIGTSTP %lu forwarded, %lu ignored\n",
+        sigForwarded[0], sigIgnored[0], sigForwarded[1], sigForwarded[2], sigIgnored[2]);
+    if (limit >= 0 && (fwd > limit || notify > limit)) {
+        error("ERROR: sigstat: p99 above %ldus\n", limit);
+        return 1;
+    }
+    return 0;
+}
+
+// spawn-many: launches through a tree of short-lived helpers that fork in parallel
+#define FANOUT 8      // helpers forked by each helper
+#define LEAFBATCH 128 // a helper with at most this many indices forks the leaves itself
+
+typedef struct { int index; pid_t pid; } leafReport;
+
+// toks with every {} replaced by i; the changed arguments are malloc'd, the rest shared
+static const char **leafArgs(const char **toks, int i) {
+    int n = 0;
+    while (toks[n]) n++;
+    const char **argv = malloc((n + 1) * sizeof(*argv));
+    char num[16];
+    int numLen = snprintf(num, sizeof(num), "%d", i);
+    for (int t = 0; t < n; t++) {
+        const char *hole = strstr(toks[t], "{}");
+        if (hole == NULL) {
+            argv[t] = toks[t];
+            continue;
+        }
+        char *arg = malloc(strlen(toks[t]) * numLen + 1), *to = arg;
+        for (const char *from = toks[t]; *from; ) {
+            if (from[0] == '{' && from[1] == '}') {
+                memcpy(to, num, numLen);
+                to += numLen;
+                from += 2;
+            } else {
+                *to++ = *from++;
+            }
+        }
+        *to = '\0';
+        argv[t] = arg;
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+static void freeLeafArgs(const char **argv, const char **toks) {
+    for (int t = 0; argv[t]; t++) {
+        if (argv[t] != toks[t]) free((char *)argv[t]);
+    }
+    free(argv);
+}
+
+// the leaf for index i, exec'd in its own process group
+static void spawnLeaf(const char **toks, int i) {
+    setpgid(0, 0);
+    sigprocmask(SIG_SETMASK, &origMask, NULL);
+    applyLimits(launchLimits);
+    tagJob();
+    const char **argv = leafArgs(toks, i);
+    execvp(argv[0], (char *const *)argv);
+    error("ERROR: cannot run %s\n", argv[0]);
+    _exit(EXIT_FAILURE);
+}
+
+// runs in a helper: covers indices [lo, hi), reporting every leaf through report
+static void spawnRange(const char **toks, int lo, int hi, int report) {
+    if (hi - lo <= LEAFBATCH) {
+        for (int i = lo; i < hi; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(report);
+                spawnLeaf(toks, i);
+            }
+            if (pid > 0) setpgid(pid, pid);
+            leafReport r = { i, pid };
+            write(report, &r, sizeof(r));
+        }
+        return;
+    }
+    pid_t helpers[FANOUT];
+    int step = (hi - lo + FANOUT - 1) / FANOUT, count = 0;
+    for (int from = lo; from < hi; from += step) {
+        int to = from + step < hi ? from + step : hi;
+        pid_t pid = fork();
+        if (pid == 0) {
+            spawnRange(toks, from, to, report);
+            _exit(0);
+        }
+        if (pid > 0) {
+            helpers[count++] = pid;
+        } else {
+            for (int i = from; i < to; i++) {
+                leafReport r = { i, -1 };
+                write(report, &r, sizeof(r));
+            }
+        }
+    }
+    // helpers are reaped here; only leaves are left for the shell to adopt
+    for (int i = 0; i < count; i++) waitpid(helpers[i], NULL, 0);
+}
+
+// spawn-many [-s] N CMD ARGS...; starts N background jobs of CMD, with {} in ARGS replaced
+// by 1..N, and numbers them in that order. Leaves come from a fork tree whose helpers exit
+// at once, so the shell turns subreaper on to adopt them, and back off once the tree is
+// done; -s forks them one by one instead.
+static int spawnMany(const char **toks, bool bg) {
+    int first = 1;
+    bool serial = toks[1] != NULL && strcmp(toks[1], "-s") == 0;
+    if (serial) first++;
+    char *end = NULL;
+    long n = toks[first] ? strtol(toks[first], &end, 10) : 0;
+    if (toks[first] == NULL || *end != '\0' || n <= 0 || toks[first + 1] == NULL) {
+        error("ERROR: usage: spawn-many [-s] N CMD ARGS...\n");
+        return 1;
+    }
+    if (liveCount + n > MAXJOBS) {
+        error("ERROR: too many jobs\n");
+        return 1;
+    }
+    const char **cmd = toks + first + 1;
+    pid_t *pids = malloc(n * sizeof(*pids));
+    if (pids == NULL) {
+        error("ERROR: out of memory\n");
+        return 1;
+    }
+    flushOut();
+    uint64_t start = traceNow();
+    // the simulator has no real processes to fan out from
+    if (serial || sys != &osBackend) {
+        for (long i = 0; i < n; i++) {
+            const char **argv = leafArgs(cmd, i + 1);
+            uint64_t execTime;
+            pids[i] = sys->spawn(argv, NULL, NULL, &execTime);
+            freeLeafArgs(argv, cmd);
+        }
+    } else {
+        int report[2];
+        bool wasSubreaper = subreaper;
+        if ((!subreaper && !setSubreaper(true)) || pipe2(report, O_CLOEXEC) < 0) {
+            if (!wasSubreaper && subreaper) setSubreaper(false);
+            free(pids);
+            return 1;
+        }
+        for (long i = 0; i < n; i++) pids[i] = -1;
+        pid_t root = fork();
+        if (root == 0) {
+            close(report[0]);
+            close(sigFd);
+            spawnRange(cmd, 1, n + 1, report[1]);
+            _exit(0);
+        }
+        close(report[1]);
+        leafReport r[PIPE_BUF / sizeof(leafReport)];
+        ssize_t got;
+        while ((got = read(report[0], r, sizeof(r))) > 0 || (got < 0 && errno == EINTR)) {
+            for (ssize_t i = 0; i < got / (ssize_t)sizeof(r[0]); i++) pids[r[i].index - 1] = r[i].pid;
+        }
+        close(report[0]);
+        if (root > 0) waitpid(root, NULL, 0);
+        // every helper has exited, so every leaf is ours already
+        if (!wasSubreaper) setSubreaper(false);
+    }
+    uint64_t elapsed = traceNow() - start;
+
+    int started = 0;
+    for (long i = 0; i < n; i++) {
+        if (pids[i] <= 0) continue;
+        job *leaf = registerJob(pids[i], cmd[0]);
+        TRACE('i', "spawn-many", start, leaf->jobNum, pids[i], 0, cmd[0]);
+        printJob(leaf);
+        started++;
+    }
+    free(pids);
+    out("spawn-many: %d of %ld started in %.1fms (%s)\n", started, n, elapsed / 1000.0,
+        serial || sys != &osBackend ? "serial" : "fork tree");
+    return started == n ? 0 : 1;
+}
+
+// governor [off | --rate=N --burst=N --load=X --psi=X]; without arguments, shows the
+// settings and how often launches were held back
+static int governor(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        if (govRate > 0) out("rate: %g/s, burst %g\n", govRate, govBurst);
+        else out("rate: unlimited\n");
+        if (govLoad > 0) out("brake: load above %g\n", govLoad);
+        if (govPsi > 0) out("brake: cpu pressure above %g\n", govPsi);
+        out("throttled: %lu launches, %lu braked, %.1fs waiting\n", govThrottled, govBraked, govDelay / 1e6);
+        return 0;
+    }
+    if (strcmp(toks[1], "off") == 0 && toks[2] == NULL) {
+        govRate = govLoad = govPsi = 0;
+        if (govQueued) governorArm(1); // let whatever was queued go
+        return 0;
+    }
+    double rate = govRate, burst = govBurst, load = govLoad, psi = govPsi;
+    for (int i = 1; toks[i] != NULL; i++) {
+        const char *eq = strchr(toks[i], '=');
+        double *field = NULL;
+        if (strncmp(toks[i], "--rate=", 7) == 0) field = &rate;
+        else if (strncmp(toks[i], "--burst=", 8) == 0) field = &burst;
+        else if (strncmp(toks[i], "--load=", 7) == 0) field = &load;
+        else if (strncmp(toks[i], "--psi=", 6) == 0) field = &psi;
+        char *end = NULL;
+        if (field) *field = strtod(eq + 1, &end);
+        if (field == NULL || end == eq + 1 || *end != '\0' || *field < 0) {
+            error("ERROR: bad argument for governor: %s\n", toks[i]);
+            return 1;
+        }
+    }
+    if (rate > 0 && burst < 1) {
+        error("ERROR: governor burst must be at least 1\n");
+        return 1;
+    }
+    if (govTimer < 0 && (govTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        perror("ERROR");
+        return 1;
+    }
+    govRate = rate;
+    govBurst = burst;
+    govTokens = burst;
+    govLast = traceNow();
+    govLoad = load;
+    govPsi = psi;
+    if (govQueued) governorArm(1); // the new settings may let queued launches go
+    return 0;
+}
+
+// jobs the wait builtin is blocked on; reapOne() settles them as they stop or end
+typedef struct { int jobNum, status; bool settled; } waitEntry;
+
+static waitEntry *waitSet = NULL;
+static int waitSize = 0, waitSettled = 0;
+static bool waiting = false;
+static int waitFirst = -1; // status of the first job to settle, for wait -n
+
+static void waitNote(int jobNum, int status) {
+    if (waitSize == 0 && waitFirst < 0) waitFirst = status;
+    for (int i = 0; i < waitSize; i++) {
+        if (waitSet[i].jobNum != jobNum || waitSet[i].settled) continue;
+        waitSet[i].settled = true;
+        waitSet[i].status = status;
+        waitSettled++;
+        if (waitFirst < 0) waitFirst = status;
+    }
+}
+
+static bool anyRunning() {
+    for (job *j = liveHead; j; j = j->next) {
+        if (j->status == RUNNING) return true;
+    }
+    return false;
+}
+
+// wait [-n] [PID | %job]...; blocks until every running job (or every one named) has ended
+// or been suspended, or with -n until the first of them has. Each pass of the event loop
+// reaps and settles whatever is ready, so it wakes once per batch of state changes.
+// Returns the status of the last job named, or with -n the first to settle.
+static int waitBuiltin(const char **toks, bool bg) {
+    int first = 1;
+    bool any = toks[1] != NULL && strcmp(toks[1], "-n") == 0;
+    if (any) first++;
+    int count = 0;
+    bool lastMissing = false;
+    while (toks[first + count]) count++;
+    waitSet = realloc(waitSet, (count ? count : 1) * sizeof(*waitSet));
+    waitSize = waitSettled = 0;
+    waitFirst = -1;
+    for (int i = 0; i < count; i++) {
+        job *target = lookupArg("wait", toks[first + i]);
+        lastMissing = target == NULL;
+        if (target == NULL) continue;
+        bool stopped = target->status == SUSPENDED;
+        waitSet[waitSize++] = (waitEntry){ target->jobNum, stopped ? 128 + SIGTSTP : 0, stopped };
+        if (stopped) waitSettled++;
+    }
+    if (count > 0 && waitSize == 0) return 127;
+
+    bool wasBuiltin = fgBuiltin;
+    fgBuiltin = true;
+    interrupted = 0;
+    waiting = true;
+    flushOut();
+    for (;;) {
+        if (interrupted) break;
+        if (any && waitFirst >= 0) break;
+        if (waitSize > 0 ? waitSettled == waitSize : !anyRunning()) break;
+        if (!reapPending && sys->idle && sys->idle()) continue;
+        shellPoll(NULL, NULL);
+    }
+    waiting = false;
+    fgBuiltin = wasBuiltin;
+    if (interrupted) return 128 + interrupted;
+    if (any) return waitFirst >= 0 ? waitFirst : 127;
+    // like other shells, the last operand decides; one that named no job gives 127
+    return lastMissing ? 127 : waitSize > 0 ? waitSet[waitSize - 1].status : 0;
+}
+
+// a size with an optional K, M, G or T suffix, a plain count, or "unlimited"
+static bool parseLimit(const char *arg, rlim_t *value) {
+    if (strcmp(arg, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'T': shift += 10; // fall through
+        case 'G': shift += 10; // fall through
+        case 'M': shift += 10; // fall through
+        case 'K': shift += 10; end++;
+    }
+    if (end == arg || *end != '\0' || errno || arg[0] == '-' || n > (RLIM_INFINITY - 1) >> shift) return false;
+    *value = (rlim_t)n << shift;
+    return true;
+}
+
+// limit [--as=SIZE] [--nofile=N] [--cpu=SECS] [--fsize=SIZE] [CMD ARGS...]; runs the external
+// CMD under those limits on top of the defaults, or without CMD makes them the defaults for
+// every job. Plain limit lists the defaults.
+static int limit(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        for (int i = 0; i < NLIMITS; i++) {
+            if (limitDefaults.max[i] == RLIM_INFINITY) out("%s: unlimited\n", limitNames[i].name);
+            else out("%s: %llu\n", limitNames[i].name, (unsigned long long)limitDefaults.max[i]);
+        }
+        return 0;
+    }
+    jobLimits limits = limitDefaults;
+    int i = 1;
+    for (; toks[i] != NULL && strncmp(toks[i], "--", 2) == 0; i++) {
+        const char *eq = strchr(toks[i], '=');
+        int which = -1;
+        for (int l = 0; eq && l < NLIMITS; l++) {
+            if (strlen(limitNames[l].name) == (size_t)(eq - toks[i] - 2) &&
+                strncmp(toks[i] + 2, limitNames[l].name, eq - toks[i] - 2) == 0) which = l;
+        }
+        if (which < 0 || !parseLimit(eq + 1, &limits.max[which])) {
+            error("ERROR: bad argument for limit: %s\n", toks[i]);
+            return 1;
+        }
+    }
+    if (toks[i] == NULL) {
+        limitDefaults = limits;
+        return 0;
+    }
+    launchLimits = &limits; // taken by the launch, so only this job runs under them
+    return runProcess(toks + i, bg, NULL);
+}
+
+// memo caches the output and exit status of deterministic commands on disk. An entry is
+// named by two 64-bit FNV-1a hashes of everything the command may depend on. They differ
+// only in seed, so they are no real 128-bit hash: KEY.key keeps what was hashed, and a hit
+// counts only if it matches. The index is a fixed open-addressed table in a file mapped
+// into the shell, and the output lives next to it in KEY.out and KEY.err, replayed with
+// sendfile(). Shells sharing the cache take an flock() on the index around every look at it.
+#define MEMOSLOTS 4096
+#define MEMOLIMIT (512ULL << 20) // bytes of output kept; the least recently used go first
+#define MEMODRAIN 1              // seconds to wait for output once a run has ended
+
+typedef struct {
+    uint64_t key[2];  // all zero for an empty slot
+    int32_t status;
+    uint32_t size;    // kB of output, rounded up
+    int64_t used;     // time() when written or last replayed
+} memoRecord;
+
+static memoRecord *memoIndex = NULL;
+static int memoFd = -1; // the index, held open for flock()
+static char memoDir[PATH_MAX];
+static uint64_t memoLimit = MEMOLIMIT;
+static unsigned long memoHits = 0, memoMisses = 0;
+static char *memoText = NULL; // everything hashed into the current key, field by field
+static size_t memoTextLen = 0, memoTextCap = 0;
+
+static void memoHash(uint64_t key[2], const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        key[0] = (key[0] ^ p[i]) * 0x100000001b3ULL;  // FNV-1a
+        key[1] = (key[1] ^ p[i]) * 0x100000001b3ULL;
+    }
+    // a field separator that no field can contain, so ("ab","c") and ("a","bc") differ
+    key[0] = (key[0] ^ 0xff) * 0x100000001b3ULL;
+    key[1] = (key[1] ^ 0xfe) * 0x100000001b3ULL;
+    // and the field itself, with its length in front in place of the separator
+    if (memoTextLen + sizeof(len) + len > memoTextCap) {
+        memoTextCap = (memoTextLen + sizeof(len) + len) * 2;
+        memoText = realloc(memoText, memoTextCap);
+    }
+    memcpy(memoText + memoTextLen, &len, sizeof(len));
+    memcpy(memoText + memoTextLen + sizeof(len), data, len);
+    memoTextLen += sizeof(len) + len;
+}
+
+// whether fd holds exactly memoText; closes it
+static bool memoSame(int fd) {
+    struct stat st;
+    bool same = fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size == memoTextLen;
+    char buf[STREAMBUF];
+    for (size_t off = 0; same && off < memoTextLen; ) {
+        ssize_t n = pread(fd, buf, sizeof(buf), off);
+        same = n > 0 && memcmp(buf, memoText + off, n) == 0;
+        off += n;
+    }
+    if (fd >= 0) close(fd);
+    return same;
+}
+
+static void memoHashFile(uint64_t key[2], const char *path) {
+    struct stat st;
+    memoHash(key, path, strlen(path));
+    if (stat(path, &st) < 0) {
+        memoHash(key, "", 0);
+        return;
+    }
+    uint64_t meta[5] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+    memoHash(key, meta, sizeof(meta));
+}
+
+static bool memoOpen() {
+    if (memoIndex) return true;
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (base) snprintf(memoDir, sizeof(memoDir), "%s/crash-memo", base);
+    else if (home) snprintf(memoDir, sizeof(memoDir), "%s/.cache/crash-memo", home);
+    else return false;
+    char *slash = memoDir;
+    while ((slash = strchr(slash + 1, '/')) != NULL) { // mkdir -p
+        *slash = '\0';
+        mkdir(memoDir, 0755);
+        *slash = '/';
+    }
+    mkdir(memoDir, 0700);
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/index", memoDir);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, MEMOSLOTS * sizeof(memoRecord)) < 0) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, MEMOSLOTS * sizeof(memoRecord), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    memoIndex = map;
+    memoFd = fd;
+    return true;
+}
+
+// the key's slot, or the empty one it would go in; a full probe run reuses the first slot
+static memoRecord *memoSlot(const uint64_t key[2]) {
+    size_t start = key[0] % MEMOSLOTS;
+    for (size_t i = 0; i < MEMOSLOTS; i++) {
+        memoRecord *r = &memoIndex[(start + i) % MEMOSLOTS];
+        if ((r->key[0] == key[0] && r->key[1] == key[1]) || (r->key[0] == 0 && r->key[1] == 0)) return r;
+    }
+    return &memoIndex[start];
+}
+
+static void memoPath(char *path, size_t size, const uint64_t key[2], const char *ext) {
+    snprintf(path, size, "%s/%016llx%016llx.%s", memoDir, (unsigned long long)key[0],
+             (unsigned long long)key[1], ext);
+}
+
+// drops an entry and its files, shifting later members of its probe run back into the
+// hole as tableRemove() does; under the lock
+static void memoRemove(memoRecord *r) {
+    char path[PATH_MAX + 40];
+    memoPath(path, sizeof(path), r->key, "out");
+    unlink(path);
+    memoPath(path, sizeof(path), r->key, "err");
+    unlink(path);
+    memoPath(path, sizeof(path), r->key, "key");
+    unlink(path);
+    size_t i = r - memoIndex, j = i;
+    for (;;) {
+        memoIndex[i] = (memoRecord){ { 0, 0 }, 0, 0, 0 };
+        for (;;) {
+            j = (j + 1) % MEMOSLOTS;
+            if (memoIndex[j].key[0] == 0 && memoIndex[j].key[1] == 0) return;
+            size_t home = memoIndex[j].key[0] % MEMOSLOTS;
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+            break;
+        }
+        memoIndex[i] = memoIndex[j];
+        i = j;
+    }
+}
+
+// total kB held; with room set, first drops the least recently used entries until room
+// more kB fit under memoLimit. Under the lock.
+static uint64_t memoTrim(uint64_t room) {
+    for (;;) {
+        uint64_t total = 0;
+        memoRecord *oldest = NULL;
+        for (int i = 0; i < MEMOSLOTS; i++) {
+            memoRecord *r = &memoIndex[i];
+            if (r->key[0] == 0 && r->key[1] == 0) continue;
+            total += r->size;
+            if (oldest == NULL || r->used < oldest->used) oldest = r;
+        }
+        if (room == 0 || oldest == NULL || (total + room) << 10 <= memoLimit) return total;
+        memoRemove(oldest);
+    }
+}
+
+// waits for the streams a run's output went through to reach end of file; false if
+// something the run left behind still holds them, or a keyboard signal came first.
+// Either way they go on being relayed.
+static bool memoDrain(int jobNum) {
+    struct timespec wait = { MEMODRAIN, 0 };
+    bool wasBuiltin = fgBuiltin, open = true;
+    fgBuiltin = true;
+    interrupted = 0;
+    while (!interrupted) {
+        open = false;
+        for (int i = 0; i < streamCount; i++) open |= streams[i].jobNum == jobNum;
+        if (!open || shellPoll(NULL, &wait) == 0) break;
+    }
+    fgBuiltin = wasBuiltin;
+    return !open;
+}
+
+// SIZE[K|M|G] in bytes, 0 if malformed
+static uint64_t parseSize(const char *arg) {
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    int shift = *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+    if (end == arg || (shift && *++end != '\0') || *end != '\0') return 0;
+    return (uint64_t)n << shift;
+}
+
+// copies a whole file to dest without it passing through the shell
+static void replay(int fd, int dest) {
+    off_t off = 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0) return;
+    while (off < st.st_size) {
+        ssize_t n = sendfile(dest, fd, &off, st.st_size - off);
+        if (n > 0) continue;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) { // e.g. an O_APPEND file
+            char buf[STREAMBUF];
+            while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+                if (write(dest, buf, n) != n) return;
+                off += n;
+            }
+        }
+        return;
+    }
+}
+
+// memo [--env=VAR,...] [--input=FILE,...] CMD ARGS...; runs the external CMD, or replays its
+// output and exit status if the same command already ran: same binary (by inode and mtime),
+// arguments, working directory, named variables and named input files (by inode, size and
+// mtime). A first run's output is shown as it comes and kept if the run ends without being
+// stopped. memo --max-size=SIZE[K|M|G] caps the cache; plain memo shows its counters.
+static int memo(const char **toks, bool bg) {
+    if (!memoOpen()) {
+        error("ERROR: memo: cannot open a cache directory\n");
+        return 1;
+    }
+    if (toks[1] == NULL) {
+        int used = 0;
+        for (int i = 0; i < MEMOSLOTS; i++) used += memoIndex[i].key[0] || memoIndex[i].key[1];
+        flock(memoFd, LOCK_SH);
+        uint64_t kb = memoTrim(0);
+        flock(memoFd, LOCK_UN);
+        out("memo: %s, %d of %d entries, %llu of %llu kB, %lu hits, %lu misses\n", memoDir, used, MEMOSLOTS,
+            (unsigned long long)kb, (unsigned long long)(memoLimit >> 10), memoHits, memoMisses);
+        return 0;
+    }
+    if (strncmp(toks[1], "--max-size=", 11) == 0 && toks[2] == NULL) {
+        uint64_t limit = parseSize(toks[1] + 11);
+        if (limit == 0) {
+            error("ERROR: bad argument for memo: %s\n", toks[1]);
+            return 1;
+        }
+        memoLimit = limit;
+        flock(memoFd, LOCK_EX);
+        memoTrim(1); // one kB of room is as near as it gets to "fit under the new cap"
+        flock(memoFd, LOCK_UN);
+        return 0;
+    }
+    if (bg) {
+        error("ERROR: memo runs in the foreground\n");
+        return 1;
+    }
+    uint64_t key[2] = { 0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL };
+    memoTextLen = 0;
+    int i = 1;
+    for (; toks[i] && strncmp(toks[i], "--", 2) == 0; i++) {
+        bool env = strncmp(toks[i], "--env=", 6) == 0;
+        if (!env && strncmp(toks[i], "--input=", 8) != 0) {
+            error("ERROR: bad argument for memo: %s\n", toks[i]);
+            return 1;
+        }
+        for (const char *item = toks[i] + (env ? 6 : 8); *item; ) {
+            size_t len = strcspn(item, ",");
+            char name[PATH_MAX];
+            snprintf(name, sizeof(name), "%.*s", (int)len, item);
+            if (env) {
+                const char *value = getenv(name);
+                memoHash(key, name, len);
+                memoHash(key, value ? value : "\1unset", strlen(value ? value : "\1unset"));
+            } else {
+                memoHashFile(key, name);
+            }
+            item += len + (item[len] == ',');
+        }
+    }
+    const char **cmd = toks + i;
+    char *binary = cmd[0] ? resolveCommand(cmd[0]) : NULL;
+    if (binary == NULL) {
+        error(cmd[0] ? "ERROR: cannot run %s\n" : "ERROR: memo needs a command\n", cmd[0]);
+        return 1;
+    }
+    memoHashFile(key, binary);
+    free(binary);
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd))) memoHash(key, cwd, strlen(cwd));
+    for (int a = 0; cmd[a]; a++) memoHash(key, cmd[a], strlen(cmd[a]));
+    if (key[0] == 0 && key[1] == 0) key[0] = 1;
+
+    char outPath[PATH_MAX + 40], errPath[PATH_MAX + 40], keyPath[PATH_MAX + 40];
+    memoPath(outPath, sizeof(outPath), key, "out");
+    memoPath(errPath, sizeof(errPath), key, "err");
+    memoPath(keyPath, sizeof(keyPath), key, "key");
+    flushOut();
+    // once open, the files survive another shell evicting the entry
+    flock(memoFd, LOCK_EX);
+    memoRecord *slot = memoSlot(key);
+    int outFd = -1, errFd = -1, keyFd = -1, status = 0;
+    if (slot->key[0] == key[0] && slot->key[1] == key[1]) {
+        outFd = open(outPath, O_RDONLY | O_CLOEXEC);
+        errFd = open(errPath, O_RDONLY | O_CLOEXEC);
+        keyFd = open(keyPath, O_RDONLY | O_CLOEXEC);
+        slot->used = time(NULL);
+        status = slot->status;
+    }
+    flock(memoFd, LOCK_UN);
+    // a different command that happens to hash the same is a miss, and takes the entry over
+    bool same = memoSame(keyFd);
+    if (outFd >= 0 && errFd >= 0 && same) {
+        replay(outFd, STDOUT_FILENO);
+        replay(errFd, STDERR_FILENO);
+        close(outFd);
+        close(errFd);
+        memoHits++;
+        return status;
+    }
+    if (outFd >= 0) close(outFd);
+    if (errFd >= 0) close(errFd);
+
+    // a miss: the run's output is relayed as it comes and copied into unnamed files, which
+    // get names only if it ran to the end
+    memoMisses++;
+    int files[2] = { open(memoDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600),
+                     open(memoDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600) };
+    // the relay streams own these copies and close them at end of file, however late
+    int tee[2] = { files[0] >= 0 ? fcntl(files[0], F_DUPFD_CLOEXEC, 0) : -1,
+                   files[1] >= 0 ? fcntl(files[1], F_DUPFD_CLOEXEC, 0) : -1 };
+    if (tee[0] < 0 || tee[1] < 0) {
+        for (int f = 0; f < 2; f++) {
+            if (files[f] >= 0) close(files[f]);
+            if (tee[f] >= 0) close(tee[f]);
+        }
+        error("ERROR: memo: cannot create files in %s\n", memoDir);
+        return 1;
+    }
+    launchTee = tee; // taken by the launch, so only this run is copied
+    job *run = spawnJob(cmd, NULL, false);
+    int jobNum = run ? run->jobNum : 0;
+    if (run == NULL) { // never started, so no stream took them
+        close(tee[0]);
+        close(tee[1]);
+        status = 1;
+    } else {
+        waitForeground(run);
+        status = fgStatus;
+    }
+    // a run stopped with Ctrl+Z goes on being relayed when it is continued, but is not kept
+    bool ended = run && tableGet(numTable, jobNum) == NULL && status < 128 && memoDrain(jobNum);
+    struct stat outSt, errSt;
+    uint64_t kb = 0;
+    if (ended && fstat(files[0], &outSt) == 0 && fstat(files[1], &errSt) == 0) {
+        kb = ((uint64_t)outSt.st_size + errSt.st_size + 1023) >> 10;
+    }
+    keyFd = ended ? open(memoDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600) : -1;
+    if (keyFd < 0 || write(keyFd, memoText, memoTextLen) != (ssize_t)memoTextLen) ended = false;
+    if (ended && kb << 10 <= memoLimit) {
+        char fdPath[64];
+        const char *paths[3] = { outPath, errPath, keyPath };
+        int fds[3] = { files[0], files[1], keyFd };
+        flock(memoFd, LOCK_EX);
+        memoTrim(kb ? kb : 1);
+        // a full table gives up the entry where the key's probe run starts
+        while ((slot = memoSlot(key))->key[0] != 0 && (slot->key[0] != key[0] || slot->key[1] != key[1])) {
+            memoRemove(slot);
+        }
+        for (int f = 0; f < 3; f++) {
+            snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", fds[f]);
+            unlink(paths[f]);
+            if (linkat(AT_FDCWD, fdPath, AT_FDCWD, paths[f], AT_SYMLINK_FOLLOW) < 0) ended = false;
+        }
+        if (ended) *slot = (memoRecord){ { key[0], key[1] }, status, kb, time(NULL) };
+        flock(memoFd, LOCK_UN);
+    }
+    close(files[0]);
+    close(files[1]);
+    if (keyFd >= 0) close(keyFd);
+    return status;
+}
+
+// jtop: top for crash's own jobs, read through the descriptors procOpen() holds
+#define JTOP_CPU 0
+#define JTOP_RSS 1
+#define JTOP_IO 2
+#define JTOP_JOB 3
+
+typedef struct {
+    const job *j;
+    double cpu;           // percent of one CPU since the last sample, -1 if unknown
+    long long rss, rd, wr; // kB resident, bytes read and written; -1 if unknown
+    char state;
+} jobSample;
+
+static const char *const jtopKeys[] = { [JTOP_CPU] = "cpu", [JTOP_RSS] = "rss", [JTOP_IO] = "io", [JTOP_JOB] = "job" };
+static int jtopKey = JTOP_CPU;
+
+// reads one of j's /proc files into buf, through the held descriptor if there is one
+static ssize_t procRead(const job *j, int file, char *buf, size_t size) {
+    int fd = j->procFd[file];
+    if (fd < 0 && (sys != &osBackend || (fd = procOpenFile(j->PID, file)) < 0)) return -1;
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (fd != j->procFd[file]) close(fd);
+    if (n >= 0) buf[n] = '\0';
+    return n;
+}
+
+static void sampleJob(job *j, jobSample *s, uint64_t now) {
+    static long ticks = 0, pageKB = 0;
+    if (ticks == 0) {
+        ticks = sysconf(_SC_CLK_TCK);
+        pageKB = sysconf(_SC_PAGESIZE) / 1024;
+    }
+    char buf[1024], *p;
+    unsigned long utime, stime;
+    *s = (jobSample){ j, -1, -1, -1, -1, '?' };
+    // the name in stat may hold spaces and parentheses, so the fields start after the last )
+    if (procRead(j, PROC_STAT, buf, sizeof(buf)) > 0 && (p = strrchr(buf, ')')) != NULL &&
+        sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &s->state, &utime, &stime) == 3) {
+        if (j->sampledAt != 0 && now > j->sampledAt) {
+            s->cpu = (double)(utime + stime - j->cpuTicks) / ticks / ((now - j->sampledAt) / 1e6) * 100;
+        }
+        j->cpuTicks = utime + stime;
+        j->sampledAt = now;
+    }
+    long pages;
+    if (procRead(j, PROC_STATM, buf, sizeof(buf)) > 0 && sscanf(buf, "%*u %ld", &pages) == 1) {
+        s->rss = pages * pageKB;
+    }
+    if (procRead(j, PROC_IO, buf, sizeof(buf)) > 0) {
+        if ((p = strstr(buf, "\nread_bytes: ")) != NULL) s->rd = strtoll(p + 13, NULL, 10);
+        if ((p = strstr(buf, "\nwrite_bytes: ")) != NULL) s->wr = strtoll(p + 14, NULL, 10);
+    }
+}
+
+static int sampleCmp(const void *a, const void *b) {
+    const jobSample *x = a, *y = b;
+    double kx = 0, ky = 0;
+    switch (jtopKey) {
+        case JTOP_CPU: kx = x->cpu; ky = y->cpu; break;
+        case JTOP_RSS: kx = x->rss; ky = y->rss; break;
+        case JTOP_IO: kx = (double)x->rd + x->wr; ky = (double)y->rd + y->wr; break;
+    }
+    // largest first, then by job number
+    if (kx != ky) return kx < ky ? 1 : -1;
+    return (x->j->jobNum > y->j->jobNum) - (x->j->jobNum < y->j->jobNum);
+}
+
+static void outField(long long v, int width) {
+    if (v < 0) out("%*s", width, "-");
+    else out("%*lld", width, v);
+}
+
+// jtop [--interval=SECS] [--count=N] [--sort=cpu|rss|io|job]; samples every live job's CPU,
+// resident memory, disk reads and writes and state once per interval and prints them, busiest
+// first. Only each job's leader is counted, not the rest of its process group.
+static int jtop(const char **toks, bool bg) {
+    double interval = 1;
+    long count = 1;
+    for (int i = 1; toks[i] != NULL; i++) {
+        char *end = NULL;
+        bool ok = false;
+        if (strncmp(toks[i], "--interval=", 11) == 0) {
+            interval = strtod(toks[i] + 11, &end);
+            ok = end != toks[i] + 11 && *end == '\0' && interval > 0;
+        } else if (strncmp(toks[i], "--count=", 8) == 0) {
+            count = strtol(toks[i] + 8, &end, 10);
+            ok = end != toks[i] + 8 && *end == '\0' && count > 0;
+        } else if (strncmp(toks[i], "--sort=", 7) == 0) {
+            for (int k = 0; k < (int)(sizeof(jtopKeys) / sizeof(*jtopKeys)); k++) {
+                if (strcmp(toks[i] + 7, jtopKeys[k]) == 0) {
+                    jtopKey = k;
+                    ok = true;
+                }
+            }
+        }
+        if (!ok) {
+            error("ERROR: bad argument for jtop: %s\n", toks[i]);
+            return 1;
+        }
+    }
+
+    static jobSample *samples = NULL;
+    static int sampleCap = 0;
+    // a first pass so the first table already has CPU use over an interval
+    uint64_t now = traceNow();
+    jobSample scratch;
+    for (job *j = liveHead; j; j = j->next) sampleJob(j, &scratch, now);
+    for (long round = 0; round < count; round++) {
+        if (!pauseShell(interval)) break;
+        if (liveCount >= sampleCap) {
+            sampleCap = liveCount * 2 + 1;
+            samples = realloc(samples, sampleCap * sizeof(*samples));
+        }
+        int n = 0;
+        now = traceNow();
+        for (job *j = liveHead; j; j = j->next) sampleJob(j, &samples[n++], now);
+        qsort(samples, n, sizeof(*samples), sampleCmp);
+        if (round > 0) out("\n");
+        out("%6s %8s %6s %10s %12s %12s S  NAME\n", "JOB", "PID", "CPU%", "RSS kB", "READ", "WRITE");
+        for (int i = 0; i < n; i++) {
+            const jobSample *s = &samples[i];
+            out("%6d %8d ", s->j->jobNum, s->j->PID);
+            if (s->cpu < 0) out("%6s", "-");
+            else out("%6.1f", s->cpu);
+            outField(s->rss, 11);
+            outField(s->rd, 13);
+            outField(s->wr, 13);
+            out(" %c  %s\n", s->state, s->j->name);
+        }
+        flushOut();
+    }
+    return 0;
+}
+
+// command NAME ARGS... always runs the external NAME, bypassing builtins
+static int command(const char **toks, bool bg) {
+    if (toks[1] == NULL) return 0;
+    return runProcess(toks + 1, bg, NULL);
+}
+
+static const builtin *findBuiltin(const char *name);
+
+// every/repeat schedules. Their runs are ordinary jobs; one timerfd, armed for the earliest
+// slot of any schedule, drives every launch, and slots are fixed multiples of the period
+// from the start so they never drift.
+typedef struct schedule {
+    struct schedule *next;
+    int id;
+    uint64_t period;     // microseconds; 0 for repeat, whose runs start as the last one ends
+    uint64_t due;        // next slot, on the traceNow() clock
+    long left;           // runs still to start, -1 for no end
+    bool queue;          // a slot that finds the last run still going waits for it
+    int queued;          // slots waiting for the current run
+    int current;         // job number of the current run, 0 if none
+    bool deferred;       // a run is queued behind the governor
+    unsigned long runs, skipped, missed;
+    const char *argv[];  // NULL-terminated, strings copied after it
+} schedule;
+
+static schedule *schedules = NULL;
+static int nextSchedule = 1;
+
+static void scheduleArm() {
+    uint64_t due = 0;
+    for (schedule *s = schedules; s; s = s->next) {
+        if (s->period > 0 && (due == 0 || s->due < due)) due = s->due;
+    }
+    // a zero it_value disarms; traceNow() is CLOCK_MONOTONIC, like the timer
+    struct itimerspec when = { .it_value = { due / 1000000, due % 1000000 * 1000 } };
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &when, NULL);
+}
+
+// starts a run, or queues it if the governor says not yet; called from the reaper and the
+// timer, so it never waits. A run that cannot be started retires the schedule, which would
+// otherwise wait for a run that never comes; false then, and s is gone.
+static bool scheduleLaunch(schedule *s) {
+    uint64_t wait;
+    int why = governorReady(&wait);
+    s->deferred = why != 0;
+    if (s->deferred) {
+        governorDefer(why, wait);
+        return true;
+    }
+    const builtin *b = findBuiltin(s->argv[0]);
+    launchAdmitted = true;
+    job *run = spawnJob(s->argv, b && b->trivial ? b : NULL, true);
+    if (run == NULL) {
+        out("@%d  failed  %s\n", s->id, s->argv[0]);
+        scheduleFree(s);
+        return false;
+    }
+    if (s->left > 0) s->left--;
+    run->sched = s;
+    s->current = run->jobNum;
+    s->runs++;
+    printJob(run);
+    return true;
+}
+
+static void scheduleFree(schedule *s) {
+    schedule **link = &schedules;
+    while (*link != s) link = &(*link)->next;
+    *link = s->next;
+    job *run = s->current ? tableGet(numTable, s->current) : NULL;
+    if (run) run->sched = NULL;
+    free(s);
+    scheduleArm();
+}
+
+static void scheduleTick() {
+    uint64_t expirations;
+    read(timerFd, &expirations, sizeof(expirations));
+    uint64_t now = traceNow();
+    for (schedule *s = schedules, *next; s; s = next) {
+        next = s->next;
+        if (s->period == 0 || s->due > now) continue;
+        uint64_t slots = (now - s->due) / s->period + 1;
+        s->missed += slots - 1;
+        s->due += slots * s->period;
+        if (s->current == 0) scheduleLaunch(s);
+        else if (s->queue) s->queued++;
+        else s->skipped++;
+    }
+    scheduleArm();
+}
+
+// reapOne() calls this once a schedule's run has ended
+static void scheduleDone(schedule *s) {
+    s->current = 0;
+    if (s->queued > 0 && s->left != 0) {
+        s->queued--;
+        if (!scheduleLaunch(s)) return;
+    } else if (s->period == 0 && s->left != 0) {
+        if (!scheduleLaunch(s)) return;
+    }
+    if (s->left == 0 && s->current == 0) {
+        out("@%d  finished  %s\n", s->id, s->argv[0]);
+        scheduleFree(s);
+    }
+}
+
+static void listSchedules() {
+    for (schedule *s = schedules; s; s = s->next) {
+        if (s->period > 0) out("@%d  every %gs", s->id, s->period / 1e6);
+        else out("@%d  repeat", s->id);
+        if (s->left >= 0) out(", %ld left", s->left);
+        out("  %s  runs=%lu skipped=%lu missed=%lu%s\n", s->argv[0], s->runs, s->skipped, s->missed,
+            s->queued ? ", queued" : "");
+    }
+}
+
+// stops @id from launching and kills its current run
+static bool nukeSchedule(const char *arg, const procEntry *procs, size_t n) {
+    char *end;
+    long id = strtol(arg + 1, &end, 10);
+    schedule *s = schedules;
+    while (s && s->id != id) s = s->next;
+    if (arg[1] == '\0' || *end != '\0' || s == NULL) {
+        error("ERROR: no schedule %s\n", arg);
+        return false;
+    }
+    job *run = s->current ? tableGet(numTable, s->current) : NULL;
+    scheduleFree(s);
+    if (run) nukeJob(run, procs, n);
+    return true;
+}
+
+// 500ms, 2s, 1.5m, 1h, or plain seconds; 0 if malformed
+static uint64_t parseInterval(const char *arg) {
+    char *end;
+    double n = strtod(arg, &end);
+    double scale = 1e6;
+    if (strcmp(end, "ms") == 0) scale = 1e3;
+    else if (strcmp(end, "m") == 0) scale = 60e6;
+    else if (strcmp(end, "h") == 0) scale = 3600e6;
+    else if (*end != '\0' && strcmp(end, "s") != 0) return 0;
+    return end == arg || n * scale < 1000 ? 0 : (uint64_t)(n * scale);
+}
+
+static int addSchedule(const char **cmd, uint64_t period, long count, bool queue) {
+    if (timerFd < 0 && (timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        perror("ERROR");
+        return 1;
+    }
+    int argc = 0;
+    size_t bytes = 0;
+    for (; cmd[argc]; argc++) bytes += strlen(cmd[argc]) + 1;
+    schedule *s = calloc(1, sizeof(*s) + (argc + 1) * sizeof(char *) + bytes);
+    char *str = (char *)&s->argv[argc + 1];
+    for (int i = 0; i < argc; i++) {
+        s->argv[i] = strcpy(str, cmd[i]);
+        str += strlen(str) + 1;
+    }
+    s->id = nextSchedule++;
+    s->period = period;
+    s->left = count;
+    s->queue = queue;
+    s->due = traceNow() + period;
+    s->next = NULL;
+    schedule **link = &schedules;
+    while (*link) link = &(*link)->next;
+    *link = s;
+    out("@%d\n", s->id);
+    // the first run starts at once, the rest on their slots
+    if (!scheduleLaunch(s)) return 1;
+    if (s->left == 0 && s->current == 0) scheduleFree(s);
+    else scheduleArm();
+    return 0;
+}
+
+// every [--queue] INTERVAL CMD ARGS...; starts CMD now and then once per INTERVAL, as
+// schedule @id. A slot that comes while the last run is still going is skipped, or with
+// --queue held until it ends; slots the shell was too busy to take count as missed.
+static int every(const char **toks, bool bg) {
+    int i = 1;
+    bool queue = toks[1] != NULL && strcmp(toks[1], "--queue") == 0;
+    if (queue) i++;
+    uint64_t period = toks[i] ? parseInterval(toks[i]) : 0;
+    if (period == 0 || toks[i + 1] == NULL) {
+        error("ERROR: usage: every [--queue] INTERVAL CMD ARGS...\n");
+        return 1;
+    }
+    return addSchedule(toks + i + 1, period, -1, queue);
+}
+
+// repeat N CMD ARGS...; runs CMD N times in the background, each run once the last has ended
+static int repeat(const char **toks, bool bg) {
+    char *end = NULL;
+    long count = toks[1] ? strtol(toks[1], &end, 10) : 0;
+    if (toks[1] == NULL || *end != '\0' || count <= 0 || toks[2] == NULL) {
+        error("ERROR: usage: repeat N CMD ARGS...\n");
+        return 1;
+    }
+    return addSchedule(toks + 2, 0, count, false);
+}
+
+// pressure: under memory pressure, stops background jobs rather than lose one to the OOM
+// killer. A PSI trigger on /proc/pressure/memory wakes the shell when stalls pass a share of a
+// window, and each wakeup stops one more job. While any are held, a timer checks avg10 once a
+// window and continues one job per check once pressure is back down.
+#define ORDER_RSS 0    // largest resident set first
+#define ORDER_NEWEST 1 // highest job number first
+#define ORDER_OLDEST 2
+
+static const char *const pressureOrders[] = { [ORDER_RSS] = "rss", [ORDER_NEWEST] = "newest", [ORDER_OLDEST] = "oldest" };
+static int psiFd = -1;                     // the trigger, -1 when off
+static int psiTimer = -1;                  // armed while jobs are held
+static double psiAbove = 10, psiBelow = 5; // percent of time stalled: stop above, continue below
+static uint64_t psiWindow = 2000000;       // microseconds
+static int psiOrder = ORDER_RSS;
+static unsigned long psiStops = 0, psiConts = 0;
+
+// where j comes in the stop order: the highest is stopped first and continued last
+static long long pressureRank(const job *j) {
+    char buf[128];
+    long long pages = 0;
+    switch (psiOrder) {
+        case ORDER_RSS:
+            if (procRead(j, PROC_STATM, buf, sizeof(buf)) > 0) sscanf(buf, "%*u %lld", &pages);
+            return pages;
+        case ORDER_NEWEST: return j->jobNum;
+        default: return -j->jobNum;
+    }
+}
+
+static int pressureHeld() {
+    int held = 0;
+    for (job *j = liveHead; j; j = j->next) held += j->pressured;
+    return held;
+}
+
+static void pressureArm(bool on) {
+    struct timespec period = { psiWindow / 1000000, psiWindow % 1000000 * 1000 };
+    struct itimerspec when = { on ? period : (struct timespec){ 0 }, on ? period : (struct timespec){ 0 } };
+    timerfd_settime(psiTimer, 0, &when, NULL);
+}
+
+// the trigger fired: stop the running background job that ranks highest
+static void pressureStop() {
+    job *victim = NULL;
+    long long best = 0;
+    for (job *j = liveHead; j; j = j->next) {
+        if (j->status != RUNNING || j->PID == fgPID) continue;
+        long long rank = pressureRank(j);
+        if (victim == NULL || rank > best) {
+            victim = j;
+            best = rank;
+        }
+    }
+    if (victim == NULL) return;
+    TRACE('i', "pressure", 0, victim->jobNum, victim->PID, SIGSTOP, victim->name);
+    if (pressureHeld() == 0) pressureArm(true);
+    // reapOne() marks it suspended and says so, like any other stop
+    victim->pressured = 1;
+    sys->signal(-victim->PID, SIGSTOP);
+    psiStops++;
+}
+
+// continues the held job that ranks lowest; reapOne() reports it as continued
+static void pressureCont() {
+    job *next = NULL;
+    long long best = 0;
+    for (job *j = liveHead; j; j = j->next) {
+        if (!j->pressured || j->status != SUSPENDED) continue;
+        long long rank = pressureRank(j);
+        if (next == NULL || rank < best) {
+            next = j;
+            best = rank;
+        }
+    }
+    if (next == NULL) return;
+    TRACE('i', "pressure", 0, next->jobNum, next->PID, SIGCONT, next->name);
+    next->pressured = 0;
+    sys->signal(-next->PID, SIGCONT);
+    psiConts++;
+}
+
+static void pressureTick() {
+    uint64_t expirations;
+    read(psiTimer, &expirations, sizeof(expirations));
+    if (pressureAvg("/proc/pressure/memory") < psiBelow) pressureCont();
+    if (pressureHeld() == 0) pressureArm(false);
+}
+
+static void pressureOff() {
+    if (psiFd >= 0) close(psiFd);
+    psiFd = -1;
+    for (job *j = liveHead; j; j = j->next) {
+        if (!j->pressured) continue;
+        j->pressured = 0;
+        sys->signal(-j->PID, SIGCONT);
+        psiConts++;
+    }
+    if (psiTimer >= 0) pressureArm(false);
+}
+
+// pressure [on | off | --above=PCT --below=PCT --window=TIME --order=rss|newest|oldest];
+// without arguments, shows the settings and what has been held. Stops a job whenever memory
+// stalls pass PCT of a window, and continues them once avg10 drops below --below.
+static int pressure(const char **toks, bool bg) {
+    if (toks[1] == NULL) {
+        double now = pressureAvg("/proc/pressure/memory");
+        if (psiFd < 0) out("pressure: off");
+        else out("pressure: stop above %g%% per %gs, continue below %g%%, %s first",
+                 psiAbove, psiWindow / 1e6, psiBelow, pressureOrders[psiOrder]);
+        if (now >= 0) out(", now %.2f%%", now);
+        out("\nheld: %d jobs, %lu stops, %lu continues\n", pressureHeld(), psiStops, psiConts);
+        return 0;
+    }
+    if (strcmp(toks[1], "off") == 0 && toks[2] == NULL) {
+        pressureOff();
+        return 0;
+    }
+    double above = psiAbove, below = psiBelow;
+    uint64_t window = psiWindow;
+    int order = psiOrder;
+    bool on = strcmp(toks[1], "on") == 0 && toks[2] == NULL;
+    for (int i = 1; toks[i] != NULL && !on; i++) {
+        char *end = NULL;
+        bool ok = false;
+        if (strncmp(toks[i], "--above=", 8) == 0) {
+            above = strtod(toks[i] + 8, &end);
+            ok = end != toks[i] + 8 && *end == '\0' && above > 0 && above < 100;
+        } else if (strncmp(toks[i], "--below=", 8) == 0) {
+            below = strtod(toks[i] + 8, &end);
+            ok = end != toks[i] + 8 && *end == '\0' && below >= 0 && below < 100;
+        } else if (strncmp(toks[i], "--window=", 9) == 0) {
+            // the kernel takes windows from 500ms to 10s, in whole 2s without CAP_SYS_RESOURCE
+            window = parseInterval(toks[i] + 9);
+            ok = window >= 500000 && window <= 10000000;
+        } else if (strncmp(toks[i], "--order=", 8) == 0) {
+            for (int k = 0; k < (int)(sizeof(pressureOrders) / sizeof(*pressureOrders)); k++) {
+                if (strcmp(toks[i] + 8, pressureOrders[k]) == 0) {
+                    order = k;
+                    ok = true;
+                }
+            }
+        }
+        if (!ok) {
+            error("ERROR: bad argument for pressure: %s\n", toks[i]);
+            return 1;
+        }
+    }
+    if (psiTimer < 0 && (psiTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        perror("ERROR");
+        return 1;
+    }
+    char trigger[64];
+    snprintf(trigger, sizeof(trigger), "some %llu %llu", (unsigned long long)(above / 100 * window),
+             (unsigned long long)window);
+    int fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    // the kernel wants the terminating NUL too
+    if (fd < 0 || write(fd, trigger, strlen(trigger) + 1) < 0) {
+        error("ERROR: pressure: cannot watch /proc/pressure/memory: %s\n", strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    if (psiFd >= 0) close(psiFd);
+    psiFd = fd;
+    psiAbove = above;
+    psiBelow = below;
+    psiWindow = window;
+    psiOrder = order;
+    if (pressureHeld() > 0) pressureArm(true);
+    return 0;
+}
+
+#define DAG_PENDING 0
+#define DAG_RUNNING 1
+#define DAG_DONE 2
+#define DAG_FAILED 3
+#define DAG_SKIPPED 4
+
+typedef struct dagNode {
+    const char *name;
+    const char **argv;       // points into the owning dag's text
+    int *succ;               // indices of the nodes that depend on this one
+    int nSucc;
+    int waiting;             // predecessors that have not finished yet
+    int state;
+    struct dag *dag;
+} dagNode;
+
+typedef struct dag {
+    char *file;
+    char *text;
+    const char **tokStore;
+    int *succStore;
+    dagNode *nodes;
+    int nNodes;
+    int *ready;              // FIFO of launchable node indices
+    int readyHead, readyTail;
+    int running, cap;
+    int ok, failed, skipped;
+    bool pumping;            // dagPump() is on the stack for this dag
+    struct dag *next;
+} dag;
+
+static dag *dags = NULL; // dags with nodes still pending or running
+
+static void dagFree(dag *d) {
+    free(d->file);
+    free(d->text);
+    free(d->tokStore);
+    free(d->succStore);
+    free(d->nodes);
+    free(d->ready);
+    free(d);
+}
+
+static int dagNameCmp(const void *a, const void *b) {
+    const dagNode *const *x = a, *const *y = b;
+    return strcmp((*x)->name, (*y)->name);
+}
+
+static int dagFind(dagNode **byName, int n, const char *name) {
+    dagNode key = { .name = name }, *keyp = &key;
+    dagNode **found = bsearch(&keyp, byName, n, sizeof(*byName), dagNameCmp);
+    return found ? (int)(*found - (*found)->dag->nodes) : -1;
+}
+
+// marks every transitive dependent of a failed node as skipped
+static void dagSkip(dag *d, dagNode *node) {
+    for (int i = 0; i < node->nSucc; i++) {
+        dagNode *dep = &d->nodes[node->succ[i]];
+        if (dep->state != DAG_PENDING) continue;
+        dep->state = DAG_SKIPPED;
+        d->skipped++;
+        out("dag %s: skipped %s\n", d->file, dep->name);
+        dagSkip(d, dep);
+    }
+}
+
+// records a finished node; dependents become ready or are skipped
+static void dagSettle(dagNode *node, bool ok) {
+    dag *d = node->dag;
+    if (ok) {
+        node->state = DAG_DONE;
+        d->ok++;
+        for (int i = 0; i < node->nSucc; i++) {
+            dagNode *dep = &d->nodes[node->succ[i]];
+            if (--dep->waiting == 0 && dep->state == DAG_PENDING) d->ready[d->readyTail++] = dep - d->nodes;
+        }
+    } else {
+        node->state = DAG_FAILED;
+        d->failed++;
+        dagSkip(d, node);
+    }
+}
+
+// launches ready nodes up to the concurrency cap, and retires the dag once nothing is left.
+// Called from the reaper too, so a node the governor holds back is queued, not waited for.
+static void dagPump(dag *d) {
+    // a launch can reap and come back here; the outer pass carries on, and alone may free d
+    if (d->pumping) return;
+    d->pumping = true;
+    uint64_t wait;
+    int why = 0;
+    while (d->running < d->cap && d->readyHead < d->readyTail && (why = governorReady(&wait)) == 0) {
+        dagNode *node = &d->nodes[d->ready[d->readyHead++]];
+        const builtin *b = findBuiltin(node->argv[0]);
+        launchAdmitted = true;
+        job *nodeJob = spawnJob(node->argv, b && b->trivial ? b : NULL, true);
+        if (nodeJob == NULL) {
+            dagSettle(node, false);
+            continue;
+        }
+        node->state = DAG_RUNNING;
+        d->running++;
+        nodeJob->dagNode = node;
+        printJob(nodeJob);
+    }
+    d->pumping = false;
+    if (why != 0) governorDefer(why, wait);
+    if (d->running > 0 || d->readyHead < d->readyTail) return;
+    flushOut();
+
+    out("dag %s: %d succeeded, %d failed, %d skipped\n", d->file, d->ok, d->failed, d->skipped);
+    for (dag **p = &dags; *p; p = &(*p)->next) {
+        if (*p == d) {
+            *p = d->next;
+            break;
+        }
+    }
+    dagFree(d);
+}
+
+// called from the reaper when a node's job terminates
+static void dagNodeDone(dagNode *node, bool ok) {
+    dag *d = node->dag;
+    d->running--;
+    dagSettle(node, ok);
+    dagPump(d);
+}
+
+static char *readFile(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return NULL;
+    char *text = NULL;
+    size_t len = 0, cap = 0;
+    size_t n;
+    do {
+        if (cap - len < 4096) {
+            cap = cap ? cap * 2 : 8192;
+            char *grown = realloc(text, cap);
+            if (grown == NULL) break;
+            text = grown;
+        }
+        n = fread(text + len, 1, cap - len - 1, f);
+        len += n;
+    } while (n > 0);
+    fclose(f);
+    if (text) text[len] = '\0';
+    return text;
+}
+
+// parses lines of the form "NAME [DEP...] : COMMAND [ARG...]"; # starts a comment
+static dag *dagLoad(const char *file) {
+    char *text = readFile(file);
+    if (text == NULL) {
+        error("ERROR: cannot read %s\n", file);
+        return NULL;
+    }
+    size_t words = 1;
+    for (char *c = text; *c; c++) {
+        if (*c == ' ' || *c == '\t' || *c == '\n' || *c == ':') words++;
+    }
+    dag *d = calloc(1, sizeof(dag));
+    d->file = strdup(file);
+    d->text = text;
+    // per line: name, deps (NULL-terminated), argv (NULL-terminated)
+    d->tokStore = malloc(3 * words * sizeof(*d->tokStore));
+    size_t nTok = 0;
+    int nLines = 0;
+    for (char *c = text; *c; c++) nLines += *c == '\n';
+    d->nodes = calloc(nLines + 1, sizeof(dagNode));
+    size_t *depStart = malloc((nLines + 1) * sizeof(size_t));
+
+    int lineNo = 0;
+    for (char *line = text; line != NULL && *line; ) {
+        lineNo++;
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *colon = strchr(line, ':');
+        char *next = nl ? nl + 1 : NULL;
+        if (colon) *colon = '\0';
+
+        char *save, *word = strtok_r(line, " \t", &save);
+        if (word == NULL) {
+            line = next;
+            continue;
+        }
+        if (colon == NULL || word > colon) {
+            error("ERROR: %s:%d: expected NAME [DEP...] : COMMAND\n", file, lineNo);
+            goto bad;
+        }
+        dagNode *node = &d->nodes[d->nNodes];
+        node->dag = d;
+        node->name = word;
+        depStart[d->nNodes] = nTok;
+        while ((word = strtok_r(NULL, " \t", &save)) != NULL) d->tokStore[nTok++] = word;
+        d->tokStore[nTok++] = NULL;
+        node->argv = d->tokStore + nTok;
+        for (word = strtok_r(colon + 1, " \t", &save); word; word = strtok_r(NULL, " \t", &save)) {
+            d->tokStore[nTok++] = word;
+        }
+        d->tokStore[nTok++] = NULL;
+        if (node->argv[0] == NULL) {
+            error("ERROR: %s:%d: %s has no command\n", file, lineNo, node->name);
+            goto bad;
+        }
+        d->nNodes++;
+        line = next;
+    }
+
+    // resolve dependencies by name, then lay successor lists out contiguously
+    dagNode **byName = malloc((d->nNodes + 1) * sizeof(*byName));
+    for (int i = 0; i < d->nNodes; i++) byName[i] = &d->nodes[i];
+    qsort(byName, d->nNodes, sizeof(*byName), dagNameCmp);
+    for (int i = 1; i < d->nNodes; i++) {
+        if (strcmp(byName[i - 1]->name, byName[i]->name) == 0) {
+            error("ERROR: %s: %s is defined twice\n", file, byName[i]->name);
+            free(byName);
+            goto bad;
+        }
+    }
+    // resolve each dependency once, then lay successor lists out contiguously
+    int *depIdx = malloc((nTok + 1) * sizeof(int));
+    size_t nEdges = 0;
+    for (int i = 0; i < d->nNodes; i++) {
+        for (size_t t = depStart[i]; d->tokStore[t]; t++) {
+            int from = dagFind(byName, d->nNodes, d->tokStore[t]);
+            if (from < 0) {
+                error("ERROR: %s: %s depends on unknown %s\n", file, d->nodes[i].name, d->tokStore[t]);
+                free(byName);
+                free(depIdx);
+                goto bad;
+            }
+            depIdx[t] = from;
+            d->nodes[from].nSucc++;
+            d->nodes[i].waiting++;
+            nEdges++;
+        }
+    }
+    free(byName);
+    d->succStore = malloc((nEdges + 1) * sizeof(int));
+    size_t off = 0;
+    for (int i = 0; i < d->nNodes; i++) {
+        d->nodes[i].succ = d->succStore + off;
+        off += d->nodes[i].nSucc;
+        d->nodes[i].nSucc = 0;
+    }
+    for (int i = 0; i < d->nNodes; i++) {
+        for (size_t t = depStart[i]; d->tokStore[t]; t++) {
+            dagNode *from = &d->nodes[depIdx[t]];
+            from->succ[from->nSucc++] = i;
+        }
+    }
+    free(depIdx);
+    free(depStart);
+
+    // Kahn's algorithm over a scratch copy of the counts rejects cycles up front
+    d->ready = malloc((d->nNodes + 1) * sizeof(int));
+    int *waiting = malloc((d->nNodes + 1) * sizeof(int));
+    int sorted = 0;
+    for (int i = 0; i < d->nNodes; i++) {
+        waiting[i] = d->nodes[i].waiting;
+        if (waiting[i] == 0) d->ready[sorted++] = i;
+    }
+    for (int head = 0; head < sorted; head++) {
+        dagNode *node = &d->nodes[d->ready[head]];
+        for (int i = 0; i < node->nSucc; i++) {
+            if (--waiting[node->succ[i]] == 0) d->ready[sorted++] = node->succ[i];
+        }
+    }
+    free(waiting);
+    if (sorted != d->nNodes) {
+        error("ERROR: %s has a dependency cycle\n", file);
+        dagFree(d);
+        return NULL;
+    }
+    d->readyTail = 0;
+    for (int i = 0; i < d->nNodes; i++) {
+        if (d->nodes[i].waiting == 0) d->ready[d->readyTail++] = i;
+    }
+    return d;
+
+bad:
+    free(depStart);
+    dagFree(d);
+    return NULL;
+}
+
+// dag [-j N] FILE: runs FILE's commands as background jobs in dependency order
+static int dagBuiltin(const char **toks, bool bg) {
+    int i = 1;
+    long cap = sysconf(_SC_NPROCESSORS_ONLN);
+    if (toks[i] != NULL && strcmp(toks[i], "-j") == 0 && toks[i + 1] != NULL) {
+        char *end;
+        cap = strtol(toks[i + 1], &end, 10);
+        if (toks[i + 1][0] == '\0' || *end != '\0' || cap <= 0) {
+            error("ERROR: bad argument for dag: %s\n", toks[i + 1]);
+            return 1;
+        }
+        i += 2;
+    }
+    if (toks[i] == NULL || toks[i + 1] != NULL) {
+        error("ERROR: dag needs exactly one file\n");
+        return 1;
+    }
+    dag *d = dagLoad(toks[i]);
+    if (d == NULL) return 1;
+    d->cap = cap > 0 ? cap : 1;
+    d->next = dags;
+    dags = d;
+    dagPump(d);
+    return 0;
+}
+
+// the governor's timer: retries the launches it queued; any it still refuses rearm it
+static void governorTick() {
+    uint64_t expirations;
+    read(govTimer, &expirations, sizeof(expirations));
+    unsigned long deferred = govDeferred;
+    for (schedule *s = schedules, *next; s; s = next) {
+        next = s->next;
+        if (s->deferred && s->current == 0) scheduleLaunch(s);
+    }
+    for (dag *d = dags, *next; d; d = next) {
+        next = d->next;
+        dagPump(d);
+    }
+    // a wait that is still going on counts once, when it ends
+    if (govDeferred == deferred && govQueued) {
+        govDelay += traceNow() - govQueued;
+        govQueued = 0;
+    }
+}
+
+enum {
+    B_QUIT, B_JOBS, B_NUKE, B_FG, B_BG, B_COMMAND,
+    B_TRUE, B_FALSE, B_ECHO, B_PRINTF, B_KILL, B_SLEEP, B_TEST, B_BRACKET, B_DAG, B_MEM, B_TRACE, B_SUBREAPER, B_SIM, B_SIGSTAT, B_SPAWNMANY, B_GOVERNOR, B_WAIT, B_LIMIT, B_EVERY, B_REPEAT, B_UPGRADE, B_PREWARM, B_MEMO, B_JTOP, B_PRESSURE,
+};
+
+// stdin read ahead by repl(); upgrade hands on whatever follows the line being run
+static char *inBuf = NULL;
+static size_t inLen = 0;
+static size_t inLine = 0; // length of the line being run, 0 between lines
+static char inSaved;      // the byte after that line, overwritten by its terminator meanwhile
+
+#ifndef CRASH_LIBRARY
+static size_t inCap = 0;
+
+static bool growInput(size_t room) {
+    if (inCap - inLen >= room) return true;
+    size_t cap = inCap ? inCap : 4 * MAXLINE;
+    while (cap - inLen < room) cap *= 2;
+    char *grown = realloc(inBuf, cap);
+    if (grown == NULL) {
+        perror("ERROR");
+        return false;
+    }
+    inBuf = grown;
+    inCap = cap;
+    return true;
+}
+#endif
+
+// upgrade hands the job table to a fresh exec of crash. Jobs stay children of this process
+// across execve(), so the new image only has to learn about them: the state goes through a
+// memfd named by --adopt=FD. SIGCHLD stays blocked throughout, so exits during the handoff
+// remain pending and are reaped, and announced, by the new image.
+static char exePath[PATH_MAX]; // the binary as installed, which may since have been replaced
+static char **mainArgv = NULL;  // set by main(); upgrade is unavailable when embedded
+
+static uint64_t maskBits(const sigset_t *set) {
+    uint64_t bits = 0;
+    for (int sig = 1; sig <= 64 && sig < NSIG; sig++) {
+        if (sigismember(set, sig) == 1) bits |= 1ULL << (sig - 1);
+    }
+    return bits;
+}
+
+static int upgrade(const char **toks, bool bg) {
+    const char *path = toks[1] ? toks[1] : exePath;
+    if (mainArgv == NULL || sys != &osBackend || path[0] == '\0' || (toks[1] && toks[2])) {
+        error(mainArgv && sys == &osBackend && path[0] ? "ERROR: upgrade takes at most one argument\n"
+                                                       : "ERROR: upgrade is not available here\n");
+        return 1;
+    }
+    int fd = memfd_create("crash-state", 0);
+    if (fd < 0) {
+        perror("ERROR");
+        return 1;
+    }
+    dprintf(fd, "crash-state 1\nnext %d\nstatus %d\nsubreaper %d\nmask %llx\n", currJob, lastStatus,
+            subreaper, (unsigned long long)maskBits(&origMask));
+    for (job *j = liveHead; j; j = j->next) dprintf(fd, "job %d %d %d %s\n", j->jobNum, j->PID, j->status, j->name);
+    // relayed output keeps flowing; whatever was half a line is written out now
+    for (int i = 0; i < streamCount; i++) {
+        outStream *s = &streams[i];
+        if (s->len > 0) tagLine(s, "", 0);
+        fcntl(s->fd, F_SETFD, 0);
+        dprintf(fd, "stream %d %d %d\n", s->fd, s->jobNum, s->dest);
+    }
+    flushErr();
+    // typed-ahead input goes last, as raw bytes
+    if (inLen > inLine) {
+        dprintf(fd, "input %zu\n", inLen - inLine);
+        write(fd, &inSaved, 1);
+        write(fd, inBuf + inLine + 1, inLen - inLine - 1);
+    }
+
+    int argc = 0;
+    while (mainArgv[argc]) argc++;
+    char **argv = malloc((argc + 2) * sizeof(*argv));
+    char adopt[32];
+    int n = 0;
+    argv[n++] = mainArgv[0];
+    for (int i = 1; i < argc; i++) {
+        // the trace file ends here rather than being truncated by the new image
+        if (strncmp(mainArgv[i], "--adopt=", 8) != 0 && strncmp(mainArgv[i], "--trace=", 8) != 0) {
+            argv[n++] = mainArgv[i];
+        }
+    }
+    snprintf(adopt, sizeof(adopt), "--adopt=%d", fd);
+    argv[n++] = adopt;
+    argv[n] = NULL;
+    traceFinish();
+    prewarmSave();
+    flushOut();
+    if (nofileRaised) setrlimit(RLIMIT_NOFILE, &shellNofile);
+    execv(path, argv);
+    raiseNofile();
+
+    error("ERROR: cannot run %s: %s\n", path, strerror(errno));
+    free(argv);
+    close(fd);
+    for (int i = 0; i < streamCount; i++) fcntl(streams[i].fd, F_SETFD, FD_CLOEXEC);
+    return 1;
+}
+
+#ifndef CRASH_LIBRARY
+// called by main() after crash_init() with the memfd an upgrading crash passed on
+static bool adoptState(int fd) {
+    char procPath[64];
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+    char *text = readFile(procPath);
+    close(fd);
+    if (text == NULL || strncmp(text, "crash-state 1\n", 14) != 0) {
+        free(text);
+        error("ERROR: no crash state on descriptor %d\n", fd);
+        return false;
+    }
+    int adopted = 0, next = currJob;
+    char *line = text, *nl;
+    for (; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+        *nl = '\0';
+        int num, pid, status, used = 0;
+        unsigned long long mask;
+        size_t input;
+        if (sscanf(line, "next %d", &next) == 1 || sscanf(line, "status %d", &lastStatus) == 1) continue;
+        if (sscanf(line, "input %zu", &input) == 1) {
+            if (growInput(input + 1)) {
+                memcpy(inBuf, nl + 1, input);
+                inLen = input;
+            }
+            break;
+        }
+        if (sscanf(line, "subreaper %d", &num) == 1) {
+            if (num) setSubreaper(true);
+        } else if (sscanf(line, "mask %llx", &mask) == 1) {
+            sigemptyset(&origMask);
+            for (int sig = 1; sig <= 64 && sig < NSIG; sig++) {
+                if (mask & 1ULL << (sig - 1)) sigaddset(&origMask, sig);
+            }
+        } else if (sscanf(line, "job %d %d %d %n", &num, &pid, &status, &used) == 3 && used > 0) {
+            currJob = num;
+            registerJob(pid, line + used)->status = status;
+            adopted++;
+        } else if (sscanf(line, "stream %d %d %d", &fd, &num, &status) == 3) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            streamAdd(fd, num, status, -1);
+        }
+    }
+    free(text);
+    currJob = next;
+    out("upgrade: %d jobs adopted\n", adopted);
+    // anything that ended during the handoff is still waiting to be reaped
+    reapPending = true;
+    return true;
+}
+#endif
+
+static const builtin builtins[] = {
+    [B_QUIT] = { "quit", quit, false },
+    [B_JOBS] = { "jobs", jobs, false },
+    [B_NUKE] = { "nuke", nuke, false },
+    [B_FG] = { "fg", foreground, false },
+    [B_BG] = { "bg", background, false },
+    [B_COMMAND] = { "command", command, false },
+    [B_TRUE] = { "true", trueBuiltin, true },
+    [B_FALSE] = { "false", falseBuiltin, true },
+    [B_ECHO] = { "echo", echo, true },
+    [B_PRINTF] = { "printf", printfBuiltin, true },
+    [B_KILL] = { "kill", killBuiltin, false },
+    [B_SLEEP] = { "sleep", sleepBuiltin, true, true },
+    [B_TEST] = { "test", testBuiltin, true },
+    [B_BRACKET] = { "[", testBuiltin, true },
+    [B_DAG] = { "dag", dagBuiltin, false },
+    [B_MEM] = { "mem", mem, false },
+    [B_TRACE] = { "trace", traceBuiltin, false },
+    [B_SUBREAPER] = { "subreaper", subreaperBuiltin, false },
+    [B_SIM] = { "sim", simBuiltin, false },
+    [B_SIGSTAT] = { "sigstat", sigstat, false },
+    [B_SPAWNMANY] = { "spawn-many", spawnMany, false },
+    [B_GOVERNOR] = { "governor", governor, false },
+    [B_WAIT] = { "wait", waitBuiltin, false },
+    [B_LIMIT] = { "limit", limit, false },
+    [B_EVERY] = { "every", every, false },
+    [B_REPEAT] = { "repeat", repeat, false },
+    [B_UPGRADE] = { "upgrade", upgrade, false },
+    [B_PREWARM] = { "prewarm", prewarm, false },
+    [B_MEMO] = { "memo", memo, false },
+    [B_JTOP] = { "jtop", jtop, false },
+    [B_PRESSURE] = { "pressure", pressure, false },
+};
+
+// perfect hash on the first few characters, so a lookup costs at most one strcmp
+static const builtin *findBuiltin(const char *name) {
+    // the first four characters, NUL-padded so that short names are safe to index
+    char key[4] = { 0 };
+    for (int i = 0; i < 4 && name[i] != '\0'; i++) key[i] = name[i];
+    int b;
+    switch (key[0]) {
+        case '[': b = B_BRACKET; break;
+        case 'b': b = B_BG; break;
+        case 'c': b = B_COMMAND; break;
+        case 'd': b = B_DAG; break;
+        case 'e': b = key[1] == 'c' ? B_ECHO : B_EVERY; break;
+        case 'f': b = key[1] == 'g' ? B_FG : B_FALSE; break;
+        case 'g': b = B_GOVERNOR; break;
+        case 'j': b = key[1] == 'o' ? B_JOBS : B_JTOP; break;
+        case 'l': b = B_LIMIT; break;
+        case 'k': b = B_KILL; break;
+        case 'm': b = key[3] == '\0' ? B_MEM : B_MEMO; break;
+        case 'n': b = B_NUKE; break;
+        case 'p': b = key[2] == 'i' ? B_PRINTF : key[3] == 'w' ? B_PREWARM : B_PRESSURE; break;
+        case 'q': b = B_QUIT; break;
+        case 'r': b = B_REPEAT; break;
+        case 's':
+            switch (key[1]) {
+                case 'l': b = B_SLEEP; break;
+                case 'i': b = key[2] == 'm' ? B_SIM : B_SIGSTAT; break;
+                case 'p': b = B_SPAWNMANY; break;
+                default: b = B_SUBREAPER; break;
+            }
+            break;
+        case 't': b = key[1] == 'e' ? B_TEST : key[2] == 'u' ? B_TRUE : B_TRACE; break;
+        case 'u': b = B_UPGRADE; break;
+        case 'w': b = B_WAIT; break;
+        default: return NULL;
+    }
+    return strcmp(name, builtins[b].name) == 0 ? &builtins[b] : NULL;
+}
+
+static void eval(const char **toks, bool bg) { // bg is true iff command ended with &
+    assert(toks);
+    if (*toks == NULL) return;
+    uint64_t start = TRACE_START();
+    const builtin *b = findBuiltin(toks[0]);
+    if (b == NULL) {
+        lastStatus = runProcess(toks, bg, NULL);
+    } else if ((bg && b->trivial) || (b->asJob && sys == &osBackend && sigismember(&shellMask, SIGINT))) {
+        // still a real job with a job number and notifications, just without the exec
+        lastStatus = runProcess(toks, bg, b);
+    } else {
+        lastStatus = b->run(toks, bg);
+    }
+    TRACE('X', "command", start, 0, 0, lastStatus, toks[0]);
+    flushOut();
+}
+
+// token vector shared by every line; grows geometrically and is never shrunk
+static const char **tokVec = NULL;
+static size_t tokCap = 0;
+
+static void growToks(size_t need) {
+    if (need <= tokCap) return;
+    size_t cap = tokCap ? tokCap : MAXLINE + 1;
+    while (cap < need) cap *= 2;
+    const char **grown = realloc(tokVec, cap * sizeof(*grown));
+    if (grown == NULL) {
+        perror("ERROR");
+        exit(1);
+    }
+    tokVec = grown;
+    tokCap = cap;
+}
+
+// how a command ended
+#define TERM_SEQ ';' // ;, a newline or the end of the line
+#define TERM_BG '&'
+#define TERM_AND 'A' // &&: the next command runs only if this one succeeded
+#define TERM_OR 'O'  // ||: the next command runs only if this one failed
+
+static bool isOr(const char *s) {
+    return s[0] == '|' && s[1] == '|';
+}
+
+static const char **tokenize(char **line, char *term) {
+    char *s = *line;
+    assert(s);
+    if (*s == '\0') return NULL;
+    // grown as tokens turn up, so splitting a line costs O(its length) however many commands it holds
+    growToks(2);
+    bool end = false;
+    int t = 0;
+    *term = TERM_SEQ;
+
+    while (*s != '\0' && !end) {
+        while (*s == '\n' || *s == '\t' || *s == ' ') ++s;
+        if (*s != ';' && *s != '&' && *s != '\0' && !isOr(s)) {
+            growToks(t + 2); // room for this one and the NULL terminator
+            tokVec[t++] = s;
+        }
+        // a lone | is an ordinary character; only || is an operator
+        while (strchr("&;\n\t ", *s) == NULL && !isOr(s)) ++s;
+        switch (*s) {
+        case '&':
+            *term = s[1] == '&' ? TERM_AND : TERM_BG;
+            end = true;
+            break;
+        case '|':
+            *term = TERM_OR;
+            end = true;
+            break;
+        case ';':
+            end = true;
+            break;
+        }
+        if (*term == TERM_AND || *term == TERM_OR) *s++ = '\0';
+        if (*s) *s++ = '\0';
+    }
+    tokVec[t] = NULL;
+    *line = s;
+    return tokVec;
+}
+
+const char **crash_tokenize(char **line, bool *bg) {
+    char term;
+    const char **toks = tokenize(line, &term);
+    *bg = term == TERM_BG;
+    return toks;
+}
+
+// Glob expansion (*, ?, [...]) of tokens between tokenizing and eval. Directory listings
+// come from getdents64 on the directory and are cached, keyed by path and revalidated
+// by inode and mtime, so expanding a pattern over a huge directory does not rescan it.
+typedef struct {
+    char *path;             // directory as written in the pattern, "" for the cwd
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t scanned;         // wall-clock second the listing was read
+    char *names;            // NUL-separated entry names
+    uint32_t *offs;         // offsets into names
+    unsigned char *types;   // d_type per entry
+    size_t count;
+    uint64_t lastUse;
+    int pins;               // expansions currently iterating this listing
+} dirCache;
+
+static dirCache dirCaches[DIRCACHE];
+static uint64_t dirClock = 0;
+
+struct linuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static const char *scanNames; // listing being sorted by dirEntryCmp
+static const uint32_t *scanOffs;
+
+static int dirEntryCmp(const void *a, const void *b) {
+    return strcmp(scanNames + scanOffs[*(const uint32_t *)a], scanNames + scanOffs[*(const uint32_t *)b]);
+}
+
+// reads the whole directory and sorts it, so expansions come out in order
+static bool dirScan(dirCache *c, const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    size_t namesLen = 0, namesCap = 1 << 16, cap = 1024;
+    char *names = malloc(namesCap);
+    uint32_t *offs = malloc(cap * sizeof(*offs));
+    unsigned char *types = malloc(cap);
+    size_t count = 0;
+    static char buf[1 << 16];
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < n; ) {
+            struct linuxDirent64 *d = (struct linuxDirent64 *)(buf + pos);
+            pos += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            size_t len = strlen(d->d_name) + 1;
+            if (namesLen + len > namesCap) {
+                while (namesLen + len > namesCap) namesCap *= 2;
+                names = realloc(names, namesCap);
+            }
+            if (count == cap) {
+                cap *= 2;
+                offs = realloc(offs, cap * sizeof(*offs));
+                types = realloc(types, cap);
+            }
+            memcpy(names + namesLen, d->d_name, len);
+            offs[count] = namesLen;
+            types[count++] = d->d_type;
+            namesLen += len;
+        }
+    }
+    close(fd);
+    // sort once per scan so expansions come out in order without sorting every time
+    uint32_t *order = malloc((count + 1) * sizeof(*order));
+    uint32_t *sortedOffs = malloc((count + 1) * sizeof(*sortedOffs));
+    unsigned char *sortedTypes = malloc(count + 1);
+    for (size_t i = 0; i < count; i++) order[i] = i;
+    scanNames = names;
+    scanOffs = offs;
+    qsort(order, count, sizeof(*order), dirEntryCmp);
+    for (size_t i = 0; i < count; i++) {
+        sortedOffs[i] = offs[order[i]];
+        sortedTypes[i] = types[order[i]];
+    }
+    free(order);
+    free(offs);
+    free(types);
+    offs = sortedOffs;
+    types = sortedTypes;
+    free(c->names);
+    free(c->offs);
+    free(c->types);
+    c->names = names;
+    c->offs = offs;
+    c->types = types;
+    c->count = count;
+    c->scanned = time(NULL);
+    return n == 0;
+}
+
+// returns dir's listing, rescanning only if the directory changed since it was cached
+static dirCache *dirList(const char *dir) {
+    const char *path = *dir ? dir : ".";
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+    dirCache *c = NULL, *victim = &dirCaches[0];
+    for (int i = 0; i < DIRCACHE; i++) {
+        if (dirCaches[i].path && strcmp(dirCaches[i].path, dir) == 0) {
+            c = &dirCaches[i];
+            break;
+        }
+        if (dirCaches[i].pins == 0 && (victim->pins > 0 || dirCaches[i].lastUse < victim->lastUse)) {
+            victim = &dirCaches[i];
+        }
+    }
+    // a listing read within a second of the mtime may have missed a same-tick change
+    bool fresh = c && c->dev == st.st_dev && c->ino == st.st_ino &&
+                 c->mtime.tv_sec == st.st_mtim.tv_sec && c->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+                 c->scanned > st.st_mtim.tv_sec + 1;
+    if (!fresh) {
+        if (c == NULL) {
+            if (victim->pins > 0) return NULL; // every slot is in use further up the walk
+            c = victim;
+            free(c->path);
+            c->path = strdup(dir);
+        }
+        if (!dirScan(c, path)) {
+            free(c->path);
+            c->path = NULL;
+            return NULL;
+        }
+        c->dev = st.st_dev;
+        c->ino = st.st_ino;
+        c->mtime = st.st_mtim;
+    }
+    c->lastUse = ++dirClock;
+    return c;
+}
+
+static bool globMagic(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[') return true;
+    }
+    return false;
+}
+
+// 1 if c is in the bracket expression at p, 0 if not, -1 if p has no closing ]
+static int globClass(const char *p, const char *pend, char c, const char **next) {
+    const char *q = p + 1;
+    bool negate = q < pend && (*q == '!' || *q == '^');
+    if (negate) q++;
+    const char *first = q;
+    while (q < pend && (*q != ']' || q == first)) q++;
+    if (q >= pend) return -1;
+    *next = q + 1;
+    bool matched = false;
+    for (const char *r = first; r < q; r++) {
+        if (r + 2 < q && r[1] == '-') {
+            if ((unsigned char)c >= (unsigned char)r[0] && (unsigned char)c <= (unsigned char)r[2]) matched = true;
+            r += 2;
+        } else if (*r == c) {
+            matched = true;
+        }
+    }
+    return matched != negate;
+}
+
+// matches name against the pattern p[0..pend); a leading '.' must be matched literally
+static bool globMatch(const char *p, const char *pend, const char *name) {
+    if (*name == '.' && *p != '.') return false;
+    const char *star = NULL, *starName = NULL;
+    while (*name) {
+        if (p < pend && *p == '*') {
+            star = ++p;
+            starName = name;
+            continue;
+        }
+        const char *next = p + 1;
+        int matched = p < pend && (*p == '?' || *p == *name);
+        if (p < pend && *p == '[') {
+            matched = globClass(p, pend, *name, &next);
+            if (matched < 0) matched = *name == '['; // an unclosed [ is literal
+        }
+        if (matched) {
+            p = next;
+            name++;
+            continue;
+        }
+        if (star == NULL) return false;
+        p = star;
+        name = ++starName;
+    }
+    while (p < pend && *p == '*') p++;
+    return p == pend;
+}
+
+// per-line storage for expanded words, released wholesale before the next line
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t used, cap;
+    char data[];
+} arenaChunk;
+
+static arenaChunk *lineArena = NULL;
+
+static char *arenaDup(const char *s, size_t len) {
+    if (lineArena == NULL || lineArena->cap - lineArena->used < len + 1) {
+        size_t cap = len + 1 > 65536 ? len + 1 : 65536;
+        arenaChunk *chunk = malloc(sizeof(arenaChunk) + cap);
+        chunk->next = lineArena;
+        chunk->used = 0;
+        chunk->cap = cap;
+        lineArena = chunk;
+    }
+    char *copy = lineArena->data + lineArena->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    lineArena->used += len + 1;
+    return copy;
+}
+
+// keeps one chunk around so steady-state globbing does not touch malloc
+static void arenaReset() {
+    while (lineArena && lineArena->next) {
+        arenaChunk *next = lineArena->next;
+        free(lineArena);
+        lineArena = next;
+    }
+    if (lineArena) lineArena->used = 0;
+}
+
+static const char **globVec = NULL;
+static size_t globLen = 0, globCap = 0;
+
+static void globPush(const char *word) {
+    if (globLen == globCap) {
+        globCap = globCap ? globCap * 2 : MAXLINE;
+        globVec = realloc(globVec, globCap * sizeof(*globVec));
+        if (globVec == NULL) {
+            perror("ERROR");
+            exit(1);
+        }
+    }
+    globVec[globLen++] = word;
+}
+
+// expands the pattern components in pat below the directory already in path[0..len)
+static void globWalk(char *path, size_t len, const char *pat) {
+    while (*pat == '/') {
+        if (len + 1 >= PATH_MAX) return;
+        path[len++] = *pat++;
+    }
+    if (*pat == '\0') {
+        path[len] = '\0';
+        struct stat st;
+        if (lstat(path, &st) == 0) globPush(arenaDup(path, len));
+        return;
+    }
+    const char *end = strchr(pat, '/');
+    size_t compLen = end ? (size_t)(end - pat) : strlen(pat);
+    if (!globMagic(pat, compLen)) {
+        if (len + compLen >= PATH_MAX) return;
+        memcpy(path + len, pat, compLen);
+        globWalk(path, len + compLen, pat + compLen);
+        return;
+    }
+
+    path[len] = '\0';
+    dirCache *dir = dirList(path);
+    if (dir == NULL) return;
+    dir->pins++;
+    for (size_t i = 0; i < dir->count; i++) {
+        const char *name = dir->names + dir->offs[i];
+        if (!globMatch(pat, pat + compLen, name)) continue;
+        size_t nameLen = strlen(name);
+        if (len + nameLen >= PATH_MAX) continue;
+        memcpy(path + len, name, nameLen);
+        if (end) {
+            // only directories can have further components
+            unsigned char type = dir->types[i];
+            if (type != DT_DIR && type != DT_UNKNOWN && type != DT_LNK) continue;
+        }
+        if (end == NULL) globPush(arenaDup(path, len + nameLen)); // the listing proves it exists
+        else globWalk(path, len + nameLen, pat + compLen);
+    }
+    dir->pins--;
+}
+
+static int globCmp(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// returns toks with every matching pattern replaced by its sorted matches; patterns that
+// match nothing are passed through literally, as sh does
+static const char **globToks(const char **toks) {
+    bool any = false;
+    for (const char **t = toks; *t && !any; t++) any = globMagic(*t, strlen(*t));
+    if (!any) return toks;
+
+    static char path[PATH_MAX];
+    globLen = 0;
+    for (const char **t = toks; *t; t++) {
+        if (!globMagic(*t, strlen(*t))) {
+            globPush(*t);
+            continue;
+        }
+        size_t first = globLen;
+        globWalk(path, 0, *t);
+        if (globLen == first) {
+            globPush(*t);
+            continue;
+        }
+        // single-directory patterns are already in order, straight from the sorted listing
+        for (size_t i = first + 1; i < globLen; i++) {
+            if (strcmp(globVec[i - 1], globVec[i]) > 0) {
+                qsort(globVec + first, globLen - first, sizeof(*globVec), globCmp);
+                break;
+            }
+        }
+    }
+    globPush(NULL);
+    return globVec;
+}
+
+static void parse_and_eval(char *s) {
+    const char **toks;
+    char term;
+    bool run = true; // false while && or || is skipping commands
+    for (;;) {
+        uint64_t start = TRACE_START();
+        if ((toks = tokenize(&s, &term)) == NULL) break;
+        if (run) {
+            toks = globToks(toks);
+            TRACE('X', "parse", start, 0, 0, 0, toks[0]);
+            eval(toks, term == TERM_BG);
+            arenaReset();
+        }
+        // a skipped command leaves lastStatus alone, so "false && a || b" runs b
+        if (term == TERM_AND) run = lastStatus == 0;
+        else if (term == TERM_OR) run = lastStatus != 0;
+        else run = true;
+    }
+}
+
+#ifndef CRASH_LIBRARY
+static void prompt() {
+    const char *prompt = "crash> ";
+    flushOut();
+    write(STDOUT_FILENO, prompt, strlen(prompt));
+}
+
+// reads stdin ourselves so notifications can be printed while the shell waits for input
+static int repl() {
+    size_t scanned = 0;
+    bool eof = false;
+    prompt();
+    while (!eof || inLen > 0) {
+        // nothing has been read yet the first time round, and inBuf may still be NULL
+        char *nl = inLen > scanned ? memchr(inBuf + scanned, '\n', inLen - scanned) : NULL;
+        if (nl != NULL || (eof && inLen > 0)) {
+            inLine = nl ? (size_t)(nl - inBuf) + 1 : inLen;
+            inSaved = inBuf[inLine];
+            inBuf[inLine] = '\0';
+            parse_and_eval(inBuf);
+            inBuf[inLine] = inSaved;
+            memmove(inBuf, inBuf + inLine, inLen - inLine);
+            inLen -= inLine;
+            inLine = 0;
+            scanned = 0;
+            if (!eof) prompt();
+            continue;
+        }
+        scanned = inLen;
+        if (eof) break;
+
+        struct pollfd in = { .fd = STDIN_FILENO, .events = POLLIN };
+        if (shellPoll(&in, NULL) < 0 && errno != EINTR) break;
+        if (!(in.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+        if (!growInput(MAXLINE + 1)) return 1;
+        ssize_t n = read(STDIN_FILENO, inBuf + inLen, inCap - inLen - 1);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("ERROR");
+            return 1;
+        }
+        if (n == 0) eof = true;
+        inLen += n;
+    }
+
+    streamDrain();
+    flushOut();
+    return 0;
+}
+#endif
+
+// names the limit behind a death by signal; only CPU time and file size have signals of their own
+static const char *limitKill(const job *j, int sig) {
+    if (sig == SIGXCPU && (j->limited & 1 << LIM_CPU)) return "killed (cpu limit)";
+    if (sig == SIGXFSZ && (j->limited & 1 << LIM_FSIZE)) return "killed (fsize limit)";
+    return NULL;
+}
+
+// records one waitpid() result against its job; O(1) via the PID table
+static void reapOne(pid_t pidOut, int status) {
+    job *deadJob = tableGet(pidTable, pidOut);
+    if (deadJob == NULL) { // an adopted orphan, reaped quietly
+        if (WIFEXITED(status) || WIFSIGNALED(status)) orphansReaped++;
+        return;
+    }
+    bool wasFG = pidOut == fgPID;
+    if (wasFG && fwdTime != 0 && !WIFCONTINUED(status)) {
+        latRecord(&notifyLatency, traceNow() - fwdTime);
+        fwdTime = 0;
+    }
+
+    if (WIFSTOPPED(status)) {
+        TRACE('i', "stopped", 0, deadJob->jobNum, pidOut, WSTOPSIG(status), deadJob->name);
+        deadJob->status = SUSPENDED;
+        printJob(deadJob);
+        if (wasFG) {
+            fgStatus = 128 + WSTOPSIG(status);
+            fgPID = 0;
+        }
+        if (waiting) waitNote(deadJob->jobNum, 128 + WSTOPSIG(status));
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        TRACE('i', "continued", 0, deadJob->jobNum, pidOut, SIGCONT, deadJob->name);
+        deadJob->pressured = 0; // whoever continued it, it is no longer held
+        // fg/bg already marked it running; only external SIGCONTs are reported
+        if (deadJob->status == SUSPENDED) {
+            deadJob->status = RUNNING;
+            printJobStatus(deadJob, "continued");
+        }
+        return;
+    }
+
+    TRACE('i', "reaped", 0, deadJob->jobNum, pidOut,
+          WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status), deadJob->name);
+    if (WIFSIGNALED(status)) {
+        deadJob->status = WCOREDUMP(status) ? DUMPED : KILLED;
+    } else {
+        deadJob->status = FINISHED;
+    }
+    tableRemove(pidTable, pidOut);
+    tableRemove(numTable, deadJob->jobNum);
+    liveRemove(deadJob);
+    liveCount--;
+    // a foreground job that simply finishes is not announced
+    const char *why = WIFSIGNALED(status) ? limitKill(deadJob, WTERMSIG(status)) : NULL;
+    if (why) printJobStatus(deadJob, why);
+    else if (!wasFG || deadJob->status != FINISHED) printJob(deadJob);
+    if (wasFG) {
+        fgStatus = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+        fgPID = 0;
+    }
+    if (waiting) waitNote(deadJob->jobNum, WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+    struct dagNode *node = deadJob->dagNode;
+    struct schedule *sched = deadJob->sched;
+    procClose(deadJob);
+    free(deadJob);
+    if (node) dagNodeDone(node, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (sched) scheduleDone(sched);
+}
+
+static int handler() {
+    struct signalfd_siginfo info[16];
+    int reaped = 0;
+    uint64_t start = TRACE_START();
+    ssize_t n;
+    while ((n = read(sigFd, info, sizeof(info))) > 0) {
+        uint64_t readTime = traceNow();
+        for (size_t i = 0; i < n / sizeof(info[0]); i++) {
+            int sig = info[i].ssi_signo;
+            if (sig == SIGCHLD) {
+                reapPending = true;
+            } else if (fgPID != 0) {
+                sys->signal(-fgPID, sig);
+                fwdTime = traceNow();
+                latRecord(&fwdLatency, fwdTime - readTime);
+                sigForwarded[sigIndex(sig)]++;
+            } else if (fgBuiltin) {
+                // Ctrl+C, Ctrl+\ and Ctrl+Z all end an in-process builtin; none reach the shell
+                interrupted = sig;
+                sigForwarded[sigIndex(sig)]++;
+            } else {
+                sigIgnored[sigIndex(sig)]++;
+                if (signalHook) signalHook(sig);
+            }
+        }
+    }
+
+    // signals coalesce, so drain everything that is ready, a batch at a time
+    if (reapPending) {
+        pid_t pidOut;
+        int status;
+        while (reaped < REAPBATCH &&
+               (pidOut = sys->reap(&status)) > 0) {
+            reapOne(pidOut, status);
+            reaped++;
+        }
+        reapPending = reaped == REAPBATCH;
+    }
+    TRACE('X', "handler", start, 0, 0, reaped, NULL);
+    flushOut();
+    return reaped;
+}
+
+int crash_init(int flags) {
+    sigemptyset(&shellMask);
+    sigaddset(&shellMask, SIGCHLD);
+    if (flags & CRASH_KEYBOARD) {
+        sigaddset(&shellMask, SIGINT);
+        sigaddset(&shellMask, SIGQUIT);
+        sigaddset(&shellMask, SIGTSTP);
+        // ignored signals never reach a signalfd, and we may have been started with them ignored
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+    }
+    sigprocmask(SIG_BLOCK, &shellMask, &origMask);
+    sigFd = signalfd(-1, &shellMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    shellPID = getpid();
+    if (sys == NULL) sys = &osBackend;
+    return sigFd;
+}
+
+void crash_eval(const char **toks, bool bg) {
+    eval(toks, bg);
+}
+
+void crash_eval_line(char *line) {
+    parse_and_eval(line);
+}
+
+int crash_spawn(const char **argv) {
+    if (argv == NULL || argv[0] == NULL) return -1;
+    job *spawned = spawnJob(argv, NULL, false);
+    return spawned ? spawned->jobNum : -1;
+}
+
+int crash_reap(void) {
+    int reaped = 0;
+    do {
+        reaped += handler();
+    } while (reapPending);
+    return reaped;
+}
+
+int crash_jobs(crash_job *out, int max) {
+    int i = 0;
+    for (job *j = liveHead; j && i < max; j = j->next, i++) {
+        out[i] = (crash_job){ j->jobNum, j->PID, statusName(j->status), j->name };
+    }
+    return liveCount;
+}
+
+int crash_signal(int jobNum, int sig) {
+    job *target = jobNum > 0 ? tableGet(numTable, jobNum) : NULL;
+    return target ? sys->signal(-target->PID, sig) : -1;
+}
+
+void crash_set_notify(void (*notify)(const crash_job *job, const char *status)) {
+    notifyHook = notify;
+}
+
+void crash_set_signal(void (*hook)(int sig)) {
+    signalHook = hook;
+}
+
+#ifndef CRASH_LIBRARY
+// as the spec has it, Ctrl+\ with nothing in the foreground quits the shell
+static void quitOnSigquit(int sig) {
+    if (sig != SIGQUIT) return;
+    flushOut();
+    exit(0);
+}
+
+int main(int argc, char **argv) {
+    int adoptFd = -1, warmTop = -1;
+    mainArgv = argv;
+    if (readlink("/proc/self/exe", exePath, sizeof(exePath) - 1) < 0) exePath[0] = '\0';
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sim") == 0) {
+            sys = &simBackend;
+        } else if (strncmp(argv[i], "--adopt=", 8) == 0) {
+            adoptFd = atoi(argv[i] + 8);
+        } else if (strcmp(argv[i], "--tag") == 0) {
+            outMode = OUT_TAG;
+        } else if (strcmp(argv[i], "--buffer") == 0) {
+            outMode = OUT_SPLICE;
+        } else if (strcmp(argv[i], "--prewarm") == 0) {
+            warmTop = PREWARMTOP;
+        } else if (strncmp(argv[i], "--prewarm=", 10) == 0) {
+            char *end;
+            warmTop = strtol(argv[i] + 10, &end, 10);
+            if (argv[i][10] == '\0' || *end != '\0' || warmTop < 0 || warmTop > PREWARMMAX) {
+                error("ERROR: bad argument for --prewarm: %s\n", argv[i] + 10);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--subreaper") == 0) {
+            if (!setSubreaper(true)) return 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            if (!traceOpen(argv[i] + 8)) {
+                perror("ERROR");
+                return 1;
+            }
+        } else {
+            error("ERROR: unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    crash_set_signal(quitOnSigquit);
+    if (crash_init(CRASH_KEYBOARD) < 0) {
+        perror("ERROR");
+        return 1;
+    }
+    raiseNofile();
+    if (adoptFd >= 0 && !adoptState(adoptFd)) return 1;
+    // simulated launches run no binaries to warm, and must not touch the real counts
+    if (warmTop >= 0 && sys == &osBackend) prewarmLoad(warmTop);
+
+    return repl();
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef CRASH_H
+#define CRASH_H
+
+// C API to crash's job-control engine, for embedding it without the REPL.
+// Build with `make libcrash.a`; the crash binary is the same code plus main().
+//
+// The engine is single-threaded and keeps one job table per process. It blocks SIGCHLD
+// (and, if asked to, the keyboard signals) and receives them through the descriptor
+// returned by crash_init(); call crash_reap() whenever that descriptor is readable.
+// It never exits the process on a signal; see crash_set_signal().
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct {
+    int jobNum;
+    pid_t pid;
+    const char *status; // "running" or "suspended"
+    const char *name;   // argv[0] as launched; valid until the job is reaped
+} crash_job;
+
+// crash_init() flags
+#define CRASH_KEYBOARD 1 // also take SIGINT, SIGQUIT and SIGTSTP, as an interactive shell does
+
+// Sets up signal handling; returns a descriptor to poll for readability, or -1 with errno set.
+// SIGCHLD is blocked in the calling thread. With CRASH_KEYBOARD, SIGINT, SIGQUIT and SIGTSTP
+// are reset to their default actions and blocked too, then forwarded to the foreground job;
+// without it their dispositions and the mask are left alone.
+int crash_init(int flags);
+
+// Splits the next command off *line in place, advancing *line past its terminator.
+// Returns a NULL-terminated token vector (empty for an empty command), or NULL once the
+// line is used up. *bg is set iff the command ended with a single &; && and || also end a
+// command, but short-circuiting on them is left to the caller (crash_eval_line() does it).
+// The vector is reused by the next call.
+const char **crash_tokenize(char **line, bool *bg);
+
+// Runs one tokenized command exactly as the shell would, builtins included.
+void crash_eval(const char **toks, bool bg);
+
+// Runs a whole line as the shell would: splits it, expands globs and honours && and ||.
+// The line is modified in place.
+void crash_eval_line(char *line);
+
+// Starts argv as a background job without printing anything; returns its job number or -1.
+int crash_spawn(const char **argv);
+
+// Handles pending signals and reaps every child that has changed state; returns the
+// number of waitpid() results consumed.
+int crash_reap(void);
+
+// Copies up to max live jobs into out, in job-number order; returns the number of live jobs.
+int crash_jobs(crash_job *out, int max);
+
+// Sends sig to job jobNum's process group; returns 0, or -1 if there is no such live job.
+int crash_signal(int jobNum, int sig);
+
+// Replaces the "[n] (pid)  status  name" lines on stdout with a callback; NULL restores them.
+void crash_set_notify(void (*notify)(const crash_job *job, const char *status));
+
+// Called from crash_reap() with each keyboard signal that no foreground job or builtin took,
+// such as Ctrl+\ at an idle prompt; NULL, the default, drops them.
+void crash_set_signal(void (*hook)(int sig));
+
+#endif
@@ -0,0 +1,126 @@
+// micro-benchmarks for the libcrash C API, one per component
+// usage: tests/apibench [tokenize | eval | spawn | jobs | signal]...
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crash.h"
+
+#define SLEEPERS 1000
+
+static int fd;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double secs, long ops, const char *unit) {
+    printf("%-9s %9ld %-9s %10.0f ns each\n", name, ops, unit, secs / ops * 1e9);
+}
+
+static void quiet(const crash_job *job, const char *status) {
+}
+
+// reaps until at most left jobs remain
+static void reapDown(int left) {
+    while (crash_jobs(NULL, 0) > left) {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        poll(&p, 1, 1000);
+        crash_reap();
+    }
+}
+
+static void startSleepers() {
+    const char *argv[] = { "sleep", "60", NULL };
+    for (int i = 0; i < SLEEPERS; i++) crash_spawn(argv);
+}
+
+static void killSleepers() {
+    static crash_job jobs[SLEEPERS];
+    int n = crash_jobs(jobs, SLEEPERS);
+    for (int i = 0; i < n; i++) crash_signal(jobs[i].jobNum, SIGKILL);
+    reapDown(0);
+}
+
+static void benchTokenize() {
+    const char *cmd = "echo some words here;";
+    long cmds = 10000, rounds = 100, parsed = 0;
+    size_t len = strlen(cmd);
+    char *text = malloc(cmds * len + 1), *line = malloc(cmds * len + 1);
+    for (long i = 0; i < cmds; i++) memcpy(text + i * len, cmd, len);
+    text[cmds * len] = '\0';
+    double start = now();
+    for (long r = 0; r < rounds; r++) {
+        memcpy(line, text, cmds * len + 1);
+        char *s = line;
+        bool bg;
+        while (crash_tokenize(&s, &bg) != NULL) parsed++;
+    }
+    report("tokenize", now() - start, parsed, "commands");
+    free(text);
+    free(line);
+}
+
+static void benchEval() {
+    const char *argv[] = { "true", NULL };
+    long n = 1000000;
+    double start = now();
+    for (long i = 0; i < n; i++) crash_eval(argv, false);
+    report("eval", now() - start, n, "builtins");
+}
+
+static void benchSpawn() {
+    const char *argv[] = { "/bin/true", NULL };
+    long n = 2000;
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        crash_spawn(argv);
+        if (crash_jobs(NULL, 0) >= 64) reapDown(32);
+    }
+    reapDown(0);
+    report("spawn", now() - start, n, "jobs");
+}
+
+static void benchJobs() {
+    static crash_job jobs[SLEEPERS];
+    startSleepers();
+    long n = 10000;
+    double start = now();
+    for (long i = 0; i < n; i++) crash_jobs(jobs, SLEEPERS);
+    report("jobs", now() - start, n * SLEEPERS, "entries");
+    killSleepers();
+}
+
+static void benchSignal() {
+    static crash_job jobs[SLEEPERS];
+    startSleepers();
+    crash_jobs(jobs, SLEEPERS);
+    long n = 100000;
+    double start = now();
+    for (long i = 0; i < n; i++) crash_signal(jobs[i % SLEEPERS].jobNum, 0);
+    report("signal", now() - start, n, "signals");
+    killSleepers();
+}
+
+int main(int argc, char **argv) {
+    static const struct { const char *name; void (*run)(); } benches[] = {
+        { "tokenize", benchTokenize }, { "eval", benchEval }, { "spawn", benchSpawn },
+        { "jobs", benchJobs }, { "signal", benchSignal },
+    };
+    int count = sizeof(benches) / sizeof(*benches);
+    if ((fd = crash_init(0)) < 0) {
+        perror("crash_init");
+        return 1;
+    }
+    crash_set_notify(quiet);
+    for (int i = 0; i < count; i++) {
+        bool wanted = argc == 1;
+        for (int a = 1; a < argc; a++) wanted |= strcmp(argv[a], benches[i].name) == 0;
+        if (wanted) benches[i].run();
+    }
+    return 0;
+}
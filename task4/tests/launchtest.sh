@@ -0,0 +1,45 @@
+#!/bin/sh
+# what a builtin sets up for the one job it launches must stay with that job: runs of an
+# `every` schedule that start while it is in front may not pick any of it up. And a schedule
+# whose run cannot be started is retired and says so, rather than left waiting for it.
+# usage: tests/launchtest.sh [CRASH]
+crash=${1:-./crash}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+bad=0
+
+fail() {
+    echo "launchtest: $1"
+    sed 's/^/    /' "$dir/out"
+    bad=1
+}
+
+printf '#!/bin/sh\necho "nofile $(ulimit -n)"\n' >"$dir/lim.sh"
+printf '#!/bin/sh\necho memo-job\nsleep 1\n' >"$dir/job.sh"
+chmod +x "$dir/lim.sh" "$dir/job.sh"
+export XDG_CACHE_HOME="$dir/cache"
+
+# limit: the limited job gets 64, the schedule's runs meanwhile get the default
+printf 'every 300ms %s\nlimit --nofile=64 %s\nlimit --nofile=64 sleep 1.2\n' "$dir/lim.sh" "$dir/lim.sh" |
+    "$crash" >"$dir/out" 2>&1
+grep -c '^\(crash> \)*nofile 64$' "$dir/out" | grep -qx 1 || fail "limit reached a job it did not launch"
+
+# memo: the schedule's output is shown while the run goes on, but the replay is the run's alone
+printf 'every 300ms echo tick\nmemo %s\n' "$dir/job.sh" | "$crash" >"$dir/out" 2>&1
+grep -q tick "$dir/out" || fail "the schedule did not run next to memo"
+printf 'memo %s\nmemo\n' "$dir/job.sh" | "$crash" >"$dir/out" 2>&1
+grep -q '1 hits' "$dir/out" || fail "memo did not keep the run"
+grep -q tick "$dir/out" && fail "memo kept output from a job it did not launch"
+
+# a full job table on the simulator: the first run of @1 takes the last slot, @2 gets none
+{
+    echo "sim life 1000000"
+    awk 'BEGIN { for (i = 1; i < 65536; i++) print "x &" }'
+    printf 'repeat 2 x\nrepeat 2 x\njobs\n'
+} | "$crash" --sim 2>&1 | grep '^\(crash> \)*@' >"$dir/out"
+grep -q '@2  failed  x$' "$dir/out" || fail "a schedule that could not start a run did not say so"
+grep -q '^@2  repeat' "$dir/out" && fail "a schedule that could not start a run is still listed"
+grep -q '^@1  repeat, 1 left' "$dir/out" || fail "the schedule that did start is gone"
+
+[ $bad = 0 ] && echo "launchtest: limits and memo's copies stay with their job, failed schedules retire"
+exit $bad
@@ -0,0 +1,148 @@
+// cold against prewarmed launch latency, through libcrash: drops a binary and the libraries
+// it links from the page cache, then times a launch as it is, and one after `prewarm now`
+// had a moment to read them back in. A third launch straight after shows the cached cost.
+// usage: tests/prewarmbench [--rounds=N] [--gap=MS] [COMMAND [ARG...]]  (default cmake --version)
+// Pages that a running process has mapped cannot be dropped, so shared libraries such as
+// libc usually stay warm either way.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "crash.h"
+
+#define MAXFILES 64
+
+static int fd;
+static const char *files[MAXFILES];
+static int nFiles = 0;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void quiet(const crash_job *job, const char *status) {
+}
+
+static void run(const char *line) {
+    char *copy = strdup(line);
+    crash_eval_line(copy);
+    free(copy);
+}
+
+// what execvp() would run for name
+static char *resolve(const char *name) {
+    if (strchr(name, '/')) return realpath(name, NULL);
+    const char *dirs = getenv("PATH");
+    char candidate[PATH_MAX];
+    for (const char *dir = dirs ? dirs : "/usr/local/bin:/usr/bin:/bin"; *dir; ) {
+        size_t len = strcspn(dir, ":");
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)len, len ? dir : ".", name);
+        if (access(candidate, X_OK) == 0) return realpath(candidate, NULL);
+        dir += len + (dir[len] == ':');
+    }
+    return NULL;
+}
+
+// the binary and every library ldd says it loads
+static void findFiles(char *binary) {
+    char cmd[PATH_MAX + 32], line[PATH_MAX + 64], path[PATH_MAX];
+    files[nFiles++] = binary;
+    snprintf(cmd, sizeof(cmd), "ldd '%s' 2>/dev/null", binary);
+    FILE *ldd = popen(cmd, "r");
+    while (ldd && nFiles < MAXFILES && fgets(line, sizeof(line), ldd)) {
+        char *arrow = strstr(line, "=> ");
+        char *from = arrow ? arrow + 3 : line + strspn(line, " \t");
+        if (*from == '/' && sscanf(from, "%4095s", path) == 1) files[nFiles++] = strdup(path);
+    }
+    if (ldd) pclose(ldd);
+}
+
+static void evict() {
+    for (int i = 0; i < nFiles; i++) {
+        int f = open(files[i], O_RDONLY | O_CLOEXEC);
+        if (f < 0) continue;
+        fdatasync(f);
+        posix_fadvise(f, 0, 0, POSIX_FADV_DONTNEED);
+        close(f);
+    }
+}
+
+// one launch, from spawn to reaped
+static double launch(const char **argv) {
+    double start = now();
+    crash_spawn(argv);
+    while (crash_jobs(NULL, 0) > 0) {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        poll(&p, 1, 1000);
+        crash_reap();
+    }
+    return now() - start;
+}
+
+static int doubleCmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *t, int n) {
+    qsort(t, n, sizeof(*t), doubleCmp);
+    printf("%-7s %4d launches, p50 %8.2fms p90 %8.2fms max %8.2fms\n", name, n,
+           t[(n - 1) / 2] * 1e3, t[(n - 1) * 9 / 10] * 1e3, t[n - 1] * 1e3);
+}
+
+int main(int argc, char **argv) {
+    static const char *fallback[] = { "cmake", "--version", NULL };
+    const char **cmd = fallback;
+    int rounds = 20, gap = 100, a = 1;
+    for (; a < argc && strncmp(argv[a], "--", 2) == 0; a++) {
+        if (strncmp(argv[a], "--rounds=", 9) == 0) rounds = atoi(argv[a] + 9);
+        else if (strncmp(argv[a], "--gap=", 6) == 0) gap = atoi(argv[a] + 6);
+        else rounds = 0;
+    }
+    if (a < argc) cmd = (const char **)argv + a;
+    char *binary = resolve(cmd[0]);
+    if (rounds <= 0 || gap < 0 || binary == NULL) {
+        fprintf(stderr, binary ? "usage: tests/prewarmbench [--rounds=N] [--gap=MS] [COMMAND [ARG...]]\n"
+                               : "prewarmbench: cannot find %s\n", cmd[0]);
+        return 1;
+    }
+    findFiles(binary);
+    if ((fd = crash_init(0)) < 0) {
+        perror("crash_init");
+        return 1;
+    }
+    crash_set_notify(quiet);
+    run("prewarm --top=1");
+
+    // the command's own output would drown the numbers
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    launch(cmd); // counted, so prewarm knows it
+    double *cold = malloc(rounds * sizeof(double)), *warm = malloc(rounds * sizeof(double));
+    double *cached = malloc(rounds * sizeof(double));
+    for (int r = 0; r < rounds; r++) {
+        evict();
+        usleep(gap * 1000);
+        cold[r] = launch(cmd);
+        evict();
+        run("prewarm now");
+        usleep(gap * 1000);
+        warm[r] = launch(cmd);
+        cached[r] = launch(cmd);
+    }
+    dup2(saved, STDOUT_FILENO);
+
+    printf("%s: %d files, %dms between dropping or warming and launching\n", binary, nFiles, gap);
+    report("cold", cold, rounds);
+    report("warm", warm, rounds);
+    report("cached", cached, rounds);
+    return 0;
+}
@@ -0,0 +1,312 @@
+// keyboard signals end to end: runs crash on a pseudo-terminal, types Ctrl+C, Ctrl+\ and
+// Ctrl+Z at a foreground job, and times each keypress until the job's handler runs, and each
+// stop until crash prints "suspended". Then checks that a foreground sleep can be suspended,
+// resumed and killed like any job, that Ctrl+C and Ctrl+Z at an idle prompt
+// are ignored and that Ctrl+\ there exits crash with status 0.
+// usage: tests/ptybench [--rounds=N] [--max-p99=US] [CRASH]
+// Exits nonzero if a check fails or a p99 is above US (default 5000).
+#define _GNU_SOURCE
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TIMEOUT 5000 // ms to wait for anything crash or the job should print
+#define SHOWN 2000   // bytes of crash's output shown when a check fails
+
+typedef struct {
+    const char *name;
+    int count;
+    uint64_t *samples; // ns
+} latency;
+
+static const char keys[] = { '\003', '\034', '\032' }; // Ctrl+C, Ctrl+\, Ctrl+Z
+static const int keySigs[] = { SIGINT, SIGQUIT, SIGTSTP };
+static latency keyLat[3] = { { "Ctrl+C" }, { "Ctrl+\\" }, { "Ctrl+Z" } };
+static latency stopLat = { "suspend" };
+
+static int master;
+static pid_t shell;
+static char buf[65536];
+static size_t len;
+
+static uint64_t now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// the foreground job: reports each keyboard signal with the time its handler ran. Ctrl+Z
+// also stops it, as the default action would, and it says so once it is continued.
+static void say(const char *what, int n, uint64_t when) {
+    char line[64];
+    int l = snprintf(line, sizeof(line), "ptybench: %s %d %llu\n", what, n, (unsigned long long)when);
+    write(STDOUT_FILENO, line, l);
+}
+
+static void caught(int sig) {
+    say("sig", sig, now());
+    if (sig == SIGTSTP) {
+        raise(SIGSTOP);
+        say("back", sig, now());
+    }
+}
+
+static int child() {
+    struct sigaction sa = { .sa_handler = caught };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+    sigaction(SIGTSTP, &sa, NULL);
+    say("ready", getpid(), 0);
+    for (;;) pause();
+}
+
+static void fail(const char *what) {
+    size_t from = len > SHOWN ? len - SHOWN : 0;
+    fprintf(stderr, "ptybench: %s\nptybench: crash's last output:\n%.*s\n", what, (int)(len - from), buf + from);
+    kill(shell, SIGKILL);
+    exit(1);
+}
+
+static void type(char key) {
+    if (write(master, &key, 1) != 1) fail("writing to the terminal failed");
+}
+
+static void typeLine(const char *line) {
+    size_t n = strlen(line);
+    if (write(master, line, n) != (ssize_t)n) fail("writing to the terminal failed");
+}
+
+// reads the terminal until needle and then the end of its line show up; drops everything
+// up to that line's end and returns the rest of the line in rest. False after ms without it.
+static bool await(const char *needle, char *rest, size_t cap, int ms) {
+    uint64_t deadline = now() + ms * 1000000ull;
+    for (;;) {
+        char *hit = memmem(buf, len, needle, strlen(needle));
+        char *end = hit ? memchr(hit, '\n', buf + len - hit) : NULL;
+        if (end != NULL) {
+            hit += strlen(needle);
+            if (rest) snprintf(rest, cap, "%.*s", (int)(end - hit), hit);
+            len -= end + 1 - buf;
+            memmove(buf, end + 1, len);
+            return true;
+        }
+        uint64_t t = now();
+        if (t >= deadline) break;
+        struct pollfd p = { .fd = master, .events = POLLIN };
+        if (poll(&p, 1, (deadline - t) / 1000000 + 1) <= 0) continue;
+        if (len == sizeof(buf)) {
+            memmove(buf, buf + len / 2, len - len / 2);
+            len -= len / 2;
+        }
+        ssize_t n = read(master, buf + len, sizeof(buf) - len);
+        if (n <= 0) break;
+        len += n;
+    }
+    return false;
+}
+
+// await() that fails on timeout
+static void expect(const char *needle, char *rest, size_t cap) {
+    if (await(needle, rest, cap, TIMEOUT)) return;
+    char what[128];
+    snprintf(what, sizeof(what), "timed out waiting for \"%s\"", needle);
+    fail(what);
+}
+
+// waits for the job's "ptybench: WHAT N TIME" line; returns TIME, and N in n
+static uint64_t expectJob(const char *what, int *n) {
+    char needle[32], rest[64];
+    unsigned long long when;
+    snprintf(needle, sizeof(needle), "ptybench: %s ", what);
+    expect(needle, rest, sizeof(rest));
+    if (sscanf(rest, "%d %llu", n, &when) != 2) fail("garbled report from the job");
+    return when;
+}
+
+// waits for crash to print a prompt, after everything typed so far
+static void expectPrompt() {
+    typeLine("echo ptybench-sync\n");
+    expect("ptybench-sync", NULL, 0);
+}
+
+static void record(latency *l, uint64_t from, uint64_t to) {
+    l->samples[l->count++] = to > from ? to - from : 0;
+}
+
+static int u64Cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// prints percentiles in microseconds; returns the p99
+static double report(latency *l) {
+    int n = l->count;
+    qsort(l->samples, n, sizeof(*l->samples), u64Cmp);
+    double p99 = l->samples[(n - 1) * 99 / 100] / 1e3;
+    printf("%-8s %6d samples, p50 %7.1fus p90 %7.1fus p99 %7.1fus max %7.1fus\n", l->name, n,
+        l->samples[(n - 1) / 2] / 1e3, l->samples[(n - 1) * 9 / 10] / 1e3, p99, l->samples[n - 1] / 1e3);
+    return p99;
+}
+
+// times keypress to handler for each key in turn, and stop to "suspended" for Ctrl+Z
+static void measure(const char *self, int rounds) {
+    char cmd[4200];
+    int pid, sig;
+    snprintf(cmd, sizeof(cmd), "%s --child\n", self);
+    typeLine(cmd);
+    expectJob("ready", &pid);
+    for (int r = 0; r < rounds; r++) {
+        for (int k = 0; k < 3; k++) {
+            uint64_t pressed = now();
+            type(keys[k]);
+            uint64_t handled = expectJob("sig", &sig);
+            if (sig != keySigs[k]) fail("the job got the wrong signal");
+            record(&keyLat[k], pressed, handled);
+            if (keySigs[k] != SIGTSTP) continue;
+            expect("suspended", NULL, 0);
+            record(&stopLat, handled, now());
+            typeLine("fg %1\n");
+            expectJob("back", &sig);
+        }
+    }
+    kill(pid, SIGKILL);
+    expect("killed", NULL, 0);
+}
+
+// presses key until needle shows up; a key typed before crash has the job in front is
+// ignored, and there is nothing on the terminal to wait for instead
+static void pressUntil(char key, const char *needle, char *rest, size_t cap) {
+    for (int tries = 0; tries < TIMEOUT / 50; tries++) {
+        type(key);
+        if (await(needle, rest, cap, 50)) return;
+    }
+    char what[128];
+    snprintf(what, sizeof(what), "timed out waiting for \"%s\"", needle);
+    fail(what);
+}
+
+// the sleep builtin in front takes the keyboard like the real command: Ctrl+Z suspends it,
+// fg brings it back and Ctrl+C kills it
+static void sleepJob() {
+    char rest[64], cmd[64];
+    int pid;
+    typeLine("sleep 30\n");
+    pressUntil(keys[2], "  suspended  sleep", NULL, 0);
+    expectPrompt();
+    typeLine("jobs\n");
+    expect("] (", rest, sizeof(rest));
+    if (sscanf(rest, "%d)  suspended  sleep", &pid) != 1) fail("the suspended sleep is not listed");
+    snprintf(cmd, sizeof(cmd), "fg %d\n", pid);
+    typeLine(cmd);
+    pressUntil(keys[0], "  killed  sleep", NULL, 0);
+    expectPrompt();
+}
+
+// Ctrl+C and Ctrl+Z with nothing in front are counted as ignored and leave crash running;
+// Ctrl+\ exits it with status 0
+static void idle() {
+    const char *ignored = "0 forwarded, 1 ignored; SIGQUIT 0 forwarded; SIGTSTP 0 forwarded, 1 ignored";
+    char rest[128];
+    typeLine("sigstat reset\n");
+    expectPrompt();
+    type(keys[0]);
+    type(keys[2]);
+    expectPrompt();
+    // the keys raise their signals before the next line is readable, but crash may see
+    // that line first; a second look settles it
+    for (int tries = 0;; tries++) {
+        typeLine("sigstat\n");
+        expect("SIGINT ", rest, sizeof(rest));
+        if (strncmp(rest, ignored, strlen(ignored)) == 0) break;
+        if (tries == 10) fail("idle Ctrl+C and Ctrl+Z were not ignored");
+        usleep(10000);
+    }
+    if (waitpid(shell, NULL, WNOHANG) != 0) fail("crash died at an idle Ctrl+C or Ctrl+Z");
+
+    type(keys[1]);
+    int status;
+    for (int waited = 0; waitpid(shell, &status, WNOHANG) == 0; waited++) {
+        if (waited == TIMEOUT) fail("crash did not exit on an idle Ctrl+\\");
+        usleep(1000);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) fail("crash did not exit with status 0 on an idle Ctrl+\\");
+}
+
+int main(int argc, char **argv) {
+    const char *crash = "./crash";
+    int rounds = 5000;
+    double limit = 5000;
+    if (argc == 2 && strcmp(argv[1], "--child") == 0) return child();
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--rounds=", 9) == 0) {
+            rounds = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--max-p99=", 10) == 0) {
+            limit = atof(argv[i] + 10);
+        } else {
+            crash = argv[i];
+        }
+    }
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: tests/ptybench [--rounds=N] [--max-p99=US] [CRASH]\n");
+        return 2;
+    }
+    for (int k = 0; k < 3; k++) keyLat[k].samples = malloc(rounds * sizeof(uint64_t));
+    stopLat.samples = malloc(rounds * sizeof(uint64_t));
+
+    char self[4096];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n < 0) {
+        perror("ptybench");
+        return 1;
+    }
+    self[n] = '\0';
+
+    // default keys, no echo, so the output is only what crash and the job print; no flush on
+    // a key either, so a line typed just before one is not lost
+    struct termios tio = { 0 };
+    tio.c_iflag = ICRNL;
+    tio.c_oflag = OPOST | ONLCR;
+    tio.c_cflag = CS8 | CREAD;
+    tio.c_lflag = ISIG | ICANON | NOFLSH;
+    tio.c_cc[VINTR] = keys[0];
+    tio.c_cc[VQUIT] = keys[1];
+    tio.c_cc[VSUSP] = keys[2];
+    tio.c_cc[VEOF] = '\004';
+    tio.c_cc[VERASE] = '\177';
+    tio.c_cc[VMIN] = 1;
+    cfsetspeed(&tio, B38400);
+    shell = forkpty(&master, NULL, &tio, NULL);
+    if (shell < 0) {
+        perror("ptybench: forkpty");
+        return 1;
+    }
+    if (shell == 0) {
+        execl(crash, crash, (char *)NULL);
+        perror("ptybench: exec");
+        _exit(127);
+    }
+
+    expectPrompt();
+    measure(self, rounds);
+    sleepJob();
+    idle();
+
+    bool slow = false;
+    for (int k = 0; k < 3; k++) slow |= report(&keyLat[k]) > limit;
+    slow |= report(&stopLat) > limit;
+    printf("sleep suspends, resumes and is killed; idle Ctrl+C and Ctrl+Z ignored, idle Ctrl+\\ exits 0\n");
+    if (slow) {
+        fprintf(stderr, "ptybench: p99 above %.0fus\n", limit);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+# drives millions of simulated jobs through eval() on the --sim backend and checks the
+# notifications and the job table's invariants (sim check) along the way.
+# usage: tests/simtest.sh [CRASH] [JOBS]
+crash=${1:-./crash}
+jobs=${2:-2000000}
+batch=10000 # launches between clock advances; their exits collapse into one SIGCHLD
+held=60000  # jobs stopped, continued and killed all at once at the end
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+awk -v n="$jobs" -v batch="$batch" -v held="$held" 'BEGIN {
+    print "sim life 1"
+    for (i = 1; i <= n; i++) {
+        print "x &"
+        if (i % batch == 0) { print "sim advance 2"; print "sim check" }
+    }
+    print "sim advance 2"
+    print "sim life 1000000"
+    for (i = 1; i <= held; i++) print "x &"
+    print "sim stop"
+    print "sim check"
+    print "sim cont"
+    print "sim exit 3"
+    print "sim check"
+}' | "$crash" --sim >"$out" 2>&1
+
+awk -v n="$jobs" -v batch="$batch" -v held="$held" '
+    /ERROR/ { if (errors++ < 10) print "simtest: " $0 }
+    /sim check: ok/ { checks++ }
+    match($0, /\[[0-9]+\] \([0-9]+\)  [a-z]+/) {
+        split(substr($0, RSTART, RLENGTH), f, /[][() ]+/)
+        num = f[2]; state = f[4]
+        count[state]++
+        # two checksums over the job numbers, so a lost and a doubled notice cannot cancel out
+        sum[state] += num; sq[state] += num * num % 1000003
+        if (state == "running" && num != ++launched) { if (errors++ < 10) printf "simtest: job %d started as %d\n", launched, num }
+    }
+    END {
+        total = n + held
+        expect["running"] = expect["finished"] = total
+        expect["suspended"] = expect["continued"] = held
+        for (i = 1; i <= total; i++) {
+            want += i; wantSq += i * i % 1000003
+            if (i == n) { heldWant = -want; heldSq = -wantSq }
+        }
+        heldWant += want; heldSq += wantSq
+        for (s in expect) {
+            all = s == "running" || s == "finished"
+            if (count[s] != expect[s] || sum[s] != (all ? want : heldWant) || sq[s] != (all ? wantSq : heldSq)) {
+                printf "simtest: %d %s notices, expected %d\n", count[s], s, expect[s]
+                errors++
+            }
+        }
+        if (checks != n / batch + 2) { printf "simtest: %d of %d invariant checks passed\n", checks, n / batch + 2; errors++ }
+        if (errors) exit 1
+        printf "simtest: %d jobs, %d checks, every notification exactly once\n", total, checks
+    }' "$out"
@@ -0,0 +1,63 @@
+#!/bin/sh
+# pushes a million short jobs through the simulator and checks that crash's RSS and heap stay
+# flat: the readings after the first tenth may not grow past it by more than the slack.
+# With --real it runs twenty thousand real jobs instead, background and foreground, with and
+# without output, and also checks that no file descriptor is left open.
+# usage: tests/soak.sh [--real] [CRASH] [JOBS]
+real=0
+if [ "$1" = --real ]; then
+    real=1
+    shift
+fi
+crash=${1:-./crash}
+jobs=${2:-$([ $real = 1 ] && echo 20000 || echo 1000000)}
+slack=256 # kB
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+if [ $real = 1 ]; then
+    # batches of 200, so the process limit is never near; wait settles each one
+    awk -v n="$jobs" 'BEGIN {
+        for (i = 1; i <= n; i++) {
+            if (i % 4 == 0) print "echo soak &"
+            else if (i % 4 == 1) print "true &"
+            else if (i % 4 == 2) print "sleep 0 &"
+            else print "true"
+            if (i % 200 == 0) print "wait"
+            if (i % (n / 10) == 0) print "mem"
+        }
+    }' | "$crash" 2>&1 | grep -E '^(crash> )*(rss|heap|fds|ERROR)' >"$out"
+else
+    awk -v n="$jobs" 'BEGIN {
+        print "sim life 1"
+        for (i = 1; i <= n; i++) {
+            print "x &"
+            if (i % 1000 == 0) print "sim advance 2"
+            if (i % (n / 10) == 0) print "mem"
+        }
+        print "sim advance 2"
+        print "sim check"
+    }' | "$crash" --sim 2>&1 | grep -E '^(crash> )*(rss|heap|fds|sim check|ERROR)' >"$out"
+fi
+
+awk -v slack="$slack" -v real="$real" '
+    /ERROR/ { print "soak: " $0; bad = 1 }
+    /sim check: ok/ { checked = 1 }
+    /heap:/ { sub(/.*heap: /, ""); heap[++h] = $1 }
+    /rss:/ { sub(/.*rss: /, ""); rss[++r] = $1 }
+    /fds:/ { sub(/.*fds: /, ""); fds[++f] = $1 }
+    END {
+        if (r < 2 || f != r || !(checked || real)) { print "soak: crash did not finish"; exit 1 }
+        for (i = 2; i <= r; i++) {
+            if (rss[i] > rss[1] + slack || heap[i] > heap[1] + slack * 1024) {
+                printf "soak: reading %d of %d grew: rss %d kB -> %d kB, heap %d -> %d bytes\n", i, r, rss[1], rss[i], heap[1], heap[i]
+                bad = 1
+            }
+            if (fds[i] != fds[1]) {
+                printf "soak: reading %d of %d has %d fds open, the first had %d\n", i, r, fds[i], fds[1]
+                bad = 1
+            }
+        }
+        if (bad) exit 1
+        printf "soak: %d readings, rss %d -> %d kB, heap %d -> %d bytes, %d fds\n", r, rss[1], rss[r], heap[1], heap[r], fds[r]
+    }' "$out"
@@ -0,0 +1,27 @@
+#!/bin/sh
+# 10,000 concurrent `true` jobs: every job must be announced running exactly once and
+# finished exactly once, with none lost or doubled however the exits coalesce.
+# usage: tests/stress.sh [CRASH] [JOBS]
+crash=${1:-./crash}
+jobs=${2:-10000}
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+
+awk -v n="$jobs" 'BEGIN { for (i = 0; i < n; i++) print "command true &"; print "wait" }' |
+    "$crash" >"$out" 2>&1 || { echo "stress: crash exited with $?"; exit 1; }
+
+awk -v n="$jobs" '
+    match($0, /\[[0-9]+\] \([0-9]+\)  [a-z]+/) {
+        split(substr($0, RSTART, RLENGTH), f, /[][() ]+/)
+        seen[f[2] " " f[4]]++
+    }
+    END {
+        bad = 0
+        for (i = 1; i <= n; i++) {
+            if (seen[i " running"] != 1 || seen[i " finished"] != 1) {
+                if (bad++ < 10) printf "stress: job %d: running %d, finished %d\n", i, seen[i " running"], seen[i " finished"]
+            }
+        }
+        if (bad) { printf "stress: %d of %d jobs misreported\n", bad, n; exit 1 }
+        printf "stress: %d jobs, every notification exactly once\n", n
+    }' "$out"